@@ -0,0 +1,440 @@
+#include "../headers/main.h"
+#include "../headers/thread_pool.h"
+#include "check.h"
+#include "synthetic.h"
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+
+
+//Runs fn(first, last) over [0, count) split into chunks across the pool, returning once all are done
+void parallel_for(ThreadPool& pool, int count, const std::function<void(int, int)>& fn) {
+    int chunks = std::min(count, pool.size() * 4);
+    for (int i = 0; i < chunks; i++) {
+        int first = static_cast<int>(static_cast<long long>(count) * i / chunks);
+        int last = static_cast<int>(static_cast<long long>(count) * (i + 1) / chunks);
+        pool.submit([&fn, first, last] { fn(first, last); });
+    }
+    pool.wait_idle();
+}
+
+//Buffers of one synthetic image, filled by the scalar kernels before anything is measured
+struct BenchImage {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> rgba;
+    std::vector<unsigned int> pixels;
+    std::vector<unsigned char> grayscale;
+    std::vector<unsigned short> energy;
+    //Diagonal map of forward energy, for the forward build_seam
+    std::vector<unsigned short> diagonal;
+    std::vector<std::vector<int>> seams;
+    std::vector<int> seam_weights;
+    //The lightest seam, which the remove_seam kernel takes out of a fresh copy each run
+    std::vector<int> seam;
+
+    //Scratch copies the destructive remove_seam kernel works on
+    std::vector<unsigned int> work_pixels;
+    std::vector<unsigned short> work_energy;
+
+    size_t pixel_count() const {
+        return static_cast<size_t>(width) * height;
+    }
+};
+
+//One implementation of one kernel
+//reset restores what a previous run changed and is not measured; bytes is the memory traffic of a run.
+struct BenchKernel {
+    std::string kernel;
+    std::string variant;
+    std::function<double(const BenchImage&)> bytes;
+    std::function<void(BenchImage&)> run;
+    std::function<void(BenchImage&)> reset = nullptr;
+};
+
+struct BenchSettings {
+    std::vector<double> megapixels = {0.3, 1, 4, 16, 100};
+    std::vector<Distribution> distributions = {Distribution::flat, Distribution::noise, Distribution::natural};
+    std::vector<std::string> kernels;
+    std::vector<std::string> variants;
+    int warmup = 2;
+    int repeat = 10;
+    int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int seam_count = 100;
+    //Run the consistency checks of check.h instead of timing anything
+    bool check = false;
+};
+
+//Kernels of main.h, scalar as they are used by the carve and split across threads where their work allows
+//SIMD variants go next to the others under the variant name "simd".
+std::vector<BenchKernel> bench_kernels(ThreadPool& pool, const BenchSettings& settings) {
+    int seam_count = settings.seam_count;
+    std::vector<BenchKernel> kernels;
+
+    kernels.push_back({"convert_to_int", "scalar",
+        [](const BenchImage& image) { return image.pixel_count() * 8.0; },
+        [](BenchImage& image) { convert_to_int(image.rgba.data(), image.width, image.height, 4, image.pixels.data()); }});
+    kernels.push_back({"convert_to_int", "threaded",
+        [](const BenchImage& image) { return image.pixel_count() * 8.0; },
+        [&pool](BenchImage& image) {
+            parallel_for(pool, image.height, [&](int first, int last) {
+                size_t offset = static_cast<size_t>(first) * image.width;
+                convert_to_int(image.rgba.data() + offset * 4, image.width, last - first, 4, image.pixels.data() + offset);
+            });
+        }});
+
+    //grayscale() runs the widest luma kernel of the CPU, scalar is the plain loop it replaces
+    kernels.push_back({"grayscale", "scalar",
+        [](const BenchImage& image) { return image.pixel_count() * 5.0; },
+        [](BenchImage& image) {
+            for (int y = 0; y < image.height; y++) {
+                size_t offset = static_cast<size_t>(y) * image.width;
+                luma_row_scalar(image.pixels.data() + offset, image.grayscale.data() + offset, image.width);
+            }
+        }});
+    kernels.push_back({"grayscale", "simd",
+        [](const BenchImage& image) { return image.pixel_count() * 5.0; },
+        [](BenchImage& image) { grayscale(image.pixels.data(), image.width, image.height, image.width, image.grayscale.data()); }});
+    kernels.push_back({"grayscale", "threaded",
+        [](const BenchImage& image) { return image.pixel_count() * 5.0; },
+        [&pool](BenchImage& image) {
+            parallel_for(pool, image.height, [&](int first, int last) {
+                size_t offset = static_cast<size_t>(first) * image.width;
+                grayscale(image.pixels.data() + offset, image.width, last - first, image.width, image.grayscale.data() + offset);
+            });
+        }});
+
+    //generate_energy_map(), which is the luma of every row and gradient_magnitude() for every pixel
+    kernels.push_back({"gradient_magnitude", "scalar",
+        [](const BenchImage& image) { return image.pixel_count() * 6.0; },
+        [](BenchImage& image) { generate_energy_map(image.energy, image.pixels.data(), image.width, image.height, image.width); }});
+    kernels.push_back({"gradient_magnitude", "threaded",
+        [](const BenchImage& image) { return image.pixel_count() * 6.0; },
+        [&pool](BenchImage& image) {
+            parallel_for(pool, image.height, [&](int first, int last) {
+                generate_energy_rows(image.energy, image.pixels.data(), image.width, image.height, image.width, first, last, EnergyKind::gradient);
+            });
+        }});
+
+    //generate_energy_map() with the colour energy, scalar being the plain loop its vector kernels replace
+    kernels.push_back({"color_energy", "scalar",
+        [](const BenchImage& image) { return image.pixel_count() * 6.0; },
+        [](BenchImage& image) {
+            int width = image.width;
+            for (int y = 1; y < image.height - 1; y++) {
+                const unsigned int* row = image.pixels.data() + static_cast<size_t>(y) * width + 1;
+                color_energy_row_scalar(image.energy.data() + static_cast<size_t>(y) * width + 1, row - width, row, row + width, width - 2);
+            }
+        }});
+    kernels.push_back({"color_energy", "simd",
+        [](const BenchImage& image) { return image.pixel_count() * 6.0; },
+        [](BenchImage& image) { generate_energy_map(image.energy, image.pixels.data(), image.width, image.height, image.width, EnergyKind::color); }});
+    kernels.push_back({"color_energy", "threaded",
+        [](const BenchImage& image) { return image.pixel_count() * 6.0; },
+        [&pool](BenchImage& image) {
+            parallel_for(pool, image.height, [&](int first, int last) {
+                generate_energy_rows(image.energy, image.pixels.data(), image.width, image.height, image.width, first, last, EnergyKind::color);
+            });
+        }});
+
+    //generate_energy_map() with forward energy, which writes the diagonal map alongside the energy
+    //scalar is the same sweep with the plain loops its luma and cost kernels replace.
+    kernels.push_back({"forward_energy", "scalar",
+        [](const BenchImage& image) { return image.pixel_count() * 8.0; },
+        [](BenchImage& image) {
+            int width = image.width;
+            for (int y = 0; y < image.height; y++) {
+                size_t offset = static_cast<size_t>(y) * width;
+                luma_row_scalar(image.pixels.data() + offset, image.grayscale.data() + offset, width);
+                if (y > 0) {
+                    forward_diagonal_row_scalar(image.diagonal.data() + offset + 1, image.grayscale.data() + offset - width + 1,
+                                                image.grayscale.data() + offset + 1, width - 2);
+                }
+                forward_energy_row_scalar(image.energy.data() + offset + 1, image.grayscale.data() + offset + 1, width - 2);
+            }
+        }});
+    kernels.push_back({"forward_energy", "simd",
+        [](const BenchImage& image) { return image.pixel_count() * 8.0; },
+        [](BenchImage& image) {
+            generate_energy_map(image.energy, image.pixels.data(), image.width, image.height, image.width, EnergyKind::forward, image.diagonal.data());
+        }});
+    kernels.push_back({"forward_energy", "threaded",
+        [](const BenchImage& image) { return image.pixel_count() * 8.0; },
+        [&pool](BenchImage& image) {
+            parallel_for(pool, image.height, [&](int first, int last) {
+                generate_energy_rows(image.energy, image.pixels.data(), image.width, image.height, image.width, first, last, EnergyKind::forward,
+                                     nullptr, image.diagonal.data());
+            });
+        }});
+
+    //generate_energy_map() with the 3x3 filters on the luma
+    for (EnergyKind kind : {EnergyKind::sobel, EnergyKind::scharr, EnergyKind::laplacian, EnergyKind::entropy}) {
+        std::string name = std::string(energy_name(kind)) + "_energy";
+        kernels.push_back({name, "simd",
+            [](const BenchImage& image) { return image.pixel_count() * 6.0; },
+            [kind](BenchImage& image) { generate_energy_map(image.energy, image.pixels.data(), image.width, image.height, image.width, kind); }});
+        kernels.push_back({name, "threaded",
+            [](const BenchImage& image) { return image.pixel_count() * 6.0; },
+            [&pool, kind](BenchImage& image) {
+                parallel_for(pool, image.height, [&](int first, int last) {
+                    generate_energy_rows(image.energy, image.pixels.data(), image.width, image.height, image.width, first, last, kind);
+                });
+            }});
+    }
+
+    //generate_seams(), which is build_seam() for seam_count starting columns
+    auto seam_bytes = [seam_count](const BenchImage& image) {
+        return static_cast<double>(std::min(seam_count, image.width)) * image.height * (3 * sizeof(unsigned short) + sizeof(int));
+    };
+    kernels.push_back({"build_seam", "scalar", seam_bytes,
+        [seam_count](BenchImage& image) {
+            generate_seams(image.seams, image.seam_weights, image.energy, image.width, image.height, image.width, seam_count);
+        }});
+    //With forward energy, every step also reads the diagonal map
+    kernels.push_back({"build_seam", "forward",
+        [seam_count](const BenchImage& image) {
+            return static_cast<double>(std::min(seam_count, image.width)) * image.height * (4 * sizeof(unsigned short) + sizeof(int));
+        },
+        [seam_count](BenchImage& image) {
+            generate_seams(image.seams, image.seam_weights, image.energy, image.width, image.height, image.width, seam_count, nullptr, image.diagonal.data());
+        }});
+    kernels.push_back({"build_seam", "threaded", seam_bytes,
+        [&pool, seam_count](BenchImage& image) {
+            int spacing = std::max(1, image.width / seam_count);
+            parallel_for(pool, image.width, [&](int first, int last) {
+                for (int x = first; x < last; x++) {
+                    if (x % spacing == 0) {
+                        image.seams[x].resize(image.height);
+                        image.seams[x][0] = x;
+                        image.seam_weights[x] = 0;
+                        build_seam(image.seams[x], image.seam_weights, image.energy, image.width, image.height, image.width);
+                    }
+                    else {
+                        image.seam_weights[x] = INT32_MAX;
+                    }
+                }
+            });
+        }});
+
+    //remove_seam_at(): shifting out one seam and recalculating the energy along it
+    //Rows right of the seam are read and written once, pixel and energy.
+    kernels.push_back({"remove_seam", "scalar",
+        [](const BenchImage& image) {
+            double shifted = 0;
+            for (int x : image.seam) {
+                shifted += image.width - 1 - x;
+            }
+            return shifted * 2 * (sizeof(unsigned int) + sizeof(unsigned short));
+        },
+        [](BenchImage& image) {
+            int width = image.width;
+            remove_seam_at(image.work_pixels.data(), image.seam, image.work_energy, width, image.height, image.width);
+        },
+        [](BenchImage& image) {
+            image.work_pixels = image.pixels;
+            image.work_energy = image.energy;
+        }});
+
+    std::vector<BenchKernel> selected;
+    for (auto& kernel : kernels) {
+        bool kernel_wanted = settings.kernels.empty() || std::find(settings.kernels.begin(), settings.kernels.end(), kernel.kernel) != settings.kernels.end();
+        bool variant_wanted = settings.variants.empty() || std::find(settings.variants.begin(), settings.variants.end(), kernel.variant) != settings.variants.end();
+        if (kernel_wanted && variant_wanted) {
+            selected.push_back(std::move(kernel));
+        }
+    }
+    return selected;
+}
+
+//Synthetic image of about megapixels million pixels at 4:3, with every buffer the kernels read filled in
+std::unique_ptr<BenchImage> make_bench_image(double megapixels, Distribution distribution, int seam_count) {
+    auto image = std::make_unique<BenchImage>();
+    image->width = std::max(3, static_cast<int>(std::lround(std::sqrt(megapixels * 1e6 * 4 / 3))));
+    image->height = std::max(3, image->width * 3 / 4);
+    int width = image->width;
+    int height = image->height;
+
+    image->rgba = synthetic_rgba(width, height, distribution, 42);
+    image->pixels.resize(image->pixel_count());
+    convert_to_int(image->rgba.data(), width, height, 4, image->pixels.data());
+    image->grayscale.resize(image->pixel_count());
+    grayscale(image->pixels.data(), width, height, width, image->grayscale.data());
+    image->energy.resize(image->pixel_count());
+    image->diagonal.resize(image->pixel_count());
+    generate_energy_map(image->energy, image->pixels.data(), width, height, width, EnergyKind::forward, image->diagonal.data());
+    generate_energy_map(image->energy, image->pixels.data(), width, height, width);
+
+    image->seams.resize(width);
+    image->seam_weights.assign(width, 0);
+    generate_seams(image->seams, image->seam_weights, image->energy, width, height, width, seam_count);
+    image->seam = image->seams[lightest_seam(image->seam_weights)];
+    return image;
+}
+
+struct BenchResult {
+    double median_ms = 0;
+    double mean_ms = 0;
+    double stddev_ms = 0;
+    double min_ms = 0;
+};
+
+BenchResult measure(BenchKernel& kernel, BenchImage& image, int warmup, int repeat) {
+    std::vector<double> times;
+    for (int i = 0; i < warmup + repeat; i++) {
+        if (kernel.reset) {
+            kernel.reset(image);
+        }
+        auto start = MetricsClock::now();
+        kernel.run(image);
+        double ms = milliseconds_between(start, MetricsClock::now());
+        if (i >= warmup) {
+            times.push_back(ms);
+        }
+    }
+
+    BenchResult result;
+    std::sort(times.begin(), times.end());
+    result.min_ms = times.front();
+    result.median_ms = times.size() % 2 == 1 ? times[times.size() / 2] : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+    for (double ms : times) {
+        result.mean_ms += ms;
+    }
+    result.mean_ms /= times.size();
+    for (double ms : times) {
+        result.stddev_ms += (ms - result.mean_ms) * (ms - result.mean_ms);
+    }
+    result.stddev_ms = times.size() > 1 ? std::sqrt(result.stddev_ms / (times.size() - 1)) : 0;
+    return result;
+}
+
+std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+void print_usage() {
+    std::cout << "seamcarving_bench [options]" << std::endl << std::endl;
+    std::cout << "Times the kernels of the seam carver on synthetic images and reports the median of the repetitions." << std::endl << std::endl;
+    std::cout << "--sizes MP,MP,...\tImage sizes in megapixels, default 0.3,1,4,16,100." << std::endl;
+    std::cout << "--distributions D,...\tAny of flat, noise, natural, gradient, texture, regions and edges, default flat,noise,natural." << std::endl;
+    std::cout << "--kernels K,...\t\tAny of convert_to_int, grayscale, gradient_magnitude, color_energy, forward_energy, sobel_energy," << std::endl;
+    std::cout << "\t\t\tscharr_energy, laplacian_energy, entropy_energy, build_seam and remove_seam, default all." << std::endl;
+    std::cout << "--variants V,...\tAny of scalar, simd, threaded and forward, default all." << std::endl;
+    std::cout << "--warmup N\t\tUnmeasured runs before the measured ones, default 2." << std::endl;
+    std::cout << "--repeat N\t\tMeasured runs, default 10." << std::endl;
+    std::cout << "--threads N\t\tThreads of the threaded variants, defaults to the number of cores." << std::endl;
+    std::cout << "--seams N\t\tSeams built per search by build_seam, default 100." << std::endl;
+    std::cout << "--check\t\t\tInstead of timing, compare every vector kernel with its scalar loop and every energy map kept up" << std::endl;
+    std::cout << "\t\t\tto date over removed seams with one computed afresh, at widths from 1 up; exits with 1 on a mismatch." << std::endl;
+}
+
+bool parse_bench_options(int argc, char* argv[], BenchSettings& settings) {
+    for (int i = 1; i < argc; i++) {
+        std::string key(argv[i]);
+        if (key == "--help" || key == "-h") {
+            return false;
+        }
+        if (key == "--check") {
+            settings.check = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cout << "Error: " << key << " needs a value" << std::endl;
+            return false;
+        }
+        std::string value(argv[++i]);
+        try {
+            if (key == "--sizes") {
+                settings.megapixels.clear();
+                for (auto& size : split_list(value)) {
+                    settings.megapixels.push_back(std::stod(size));
+                }
+            }
+            else if (key == "--distributions") {
+                settings.distributions.clear();
+                for (auto& name : split_list(value)) {
+                    Distribution distribution;
+                    if (!parse_distribution(name, distribution)) {
+                        std::cout << "Error: unknown distribution " << name << std::endl;
+                        return false;
+                    }
+                    settings.distributions.push_back(distribution);
+                }
+            }
+            else if (key == "--kernels") {
+                settings.kernels = split_list(value);
+            }
+            else if (key == "--variants") {
+                settings.variants = split_list(value);
+            }
+            else if (key == "--warmup") {
+                settings.warmup = std::max(0, std::stoi(value));
+            }
+            else if (key == "--repeat") {
+                settings.repeat = std::max(1, std::stoi(value));
+            }
+            else if (key == "--threads") {
+                settings.threads = std::max(1, std::stoi(value));
+            }
+            else if (key == "--seams") {
+                settings.seam_count = std::max(1, std::stoi(value));
+            }
+            else {
+                std::cout << "Error: unknown option " << key << std::endl;
+                return false;
+            }
+        } catch (std::invalid_argument& invalidArgument) {
+            std::cout << "Error: invalid number for " << key << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchSettings settings;
+    if (!parse_bench_options(argc, argv, settings)) {
+        print_usage();
+        return 1;
+    }
+#ifndef NDEBUG
+    std::cout << "Warning: built without NDEBUG, numbers of a debug build say little about a release build" << std::endl;
+#endif
+    if (settings.check) {
+        return run_checks() ? 0 : 1;
+    }
+
+    ThreadPool pool(settings.threads);
+    std::vector<BenchKernel> kernels = bench_kernels(pool, settings);
+    if (kernels.empty()) {
+        std::cout << "Error: no kernel matches --kernels and --variants" << std::endl;
+        return 1;
+    }
+
+    printf("%-20s %-9s %-11s %-8s %10s %10s %8s %10s\n", "kernel", "variant", "size", "content", "ns/pixel", "GB/s", "cv %", "min ms");
+    for (double megapixels : settings.megapixels) {
+        for (Distribution distribution : settings.distributions) {
+            auto image = make_bench_image(megapixels, distribution, settings.seam_count);
+            std::string size = std::to_string(image->width) + "x" + std::to_string(image->height);
+            for (auto& kernel : kernels) {
+                BenchResult result = measure(kernel, *image, settings.warmup, settings.repeat);
+                double ns_per_pixel = result.median_ms * 1e6 / image->pixel_count();
+                double gigabytes_per_second = result.median_ms > 0 ? kernel.bytes(*image) / (result.median_ms * 1e6) : 0;
+                double variation = result.mean_ms > 0 ? 100 * result.stddev_ms / result.mean_ms : 0;
+                printf("%-20s %-9s %-11s %-8s %10.3f %10.2f %8.1f %10.3f\n", kernel.kernel.c_str(), kernel.variant.c_str(), size.c_str(),
+                       distribution_name(distribution), ns_per_pixel, gigabytes_per_second, variation, result.min_ms);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,206 @@
+#ifndef SEAMCARVING_CHECK_H
+#define SEAMCARVING_CHECK_H
+
+#include "../headers/main.h"
+#include "../headers/deadline.h"
+#include "synthetic.h"
+#include <cstdio>
+#include <utility>
+
+//Consistency checks of the kernels, run by seamcarving_bench --check
+//Every vector kernel must match its scalar loop, the energy map of a sweep must match the strips the recalculation
+//computes, and a map kept up to date over removed seams must match one computed afresh. The widths cover the degenerate
+//images of 1 to 3 pixels, the edges of the 8, 16 and 32 pixel steps of the vector kernels and the remainders after them.
+const int check_widths[] = {1, 2, 3, 4, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 64, 100, 257};
+const int check_heights[] = {1, 2, 3, 9};
+const Distribution check_distributions[] = {Distribution::noise, Distribution::natural};
+
+//Counts the comparisons and reports every one that fails
+class CheckLog {
+public:
+    template <typename T>
+    void expect_equal(const std::string& what, const std::vector<T>& expected, const std::vector<T>& actual) {
+        checks++;
+        for (size_t i = 0; i < expected.size(); i++) {
+            if (expected[i] != actual[i]) {
+                failures++;
+                printf("FAIL %s: first difference at %zu, %d instead of %d\n", what.c_str(), i, static_cast<int>(actual[i]), static_cast<int>(expected[i]));
+                return;
+            }
+        }
+    }
+
+    int checks = 0;
+    int failures = 0;
+};
+
+#ifdef SEAMCARVING_X86
+
+//The vector kernels of one row function this CPU runs, by name
+template <typename Kernel>
+std::vector<std::pair<const char*, Kernel>> vector_kernels(Kernel sse2, Kernel avx2) {
+    std::vector<std::pair<const char*, Kernel>> kernels;
+    kernels.emplace_back("sse2", sse2);
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.emplace_back("avx2", avx2);
+    }
+    return kernels;
+}
+
+#endif //SEAMCARVING_X86
+
+//Row kernels on three rows of width pixels, with one more pixel on either side for the neighbours they read
+//Without vector kernels there is nothing to compare.
+void check_row_kernels([[maybe_unused]] CheckLog& log, [[maybe_unused]] int width, [[maybe_unused]] Distribution distribution) {
+#ifdef SEAMCARVING_X86
+    int stride = width + 2;
+    std::vector<unsigned char> rgba = synthetic_rgba(stride, 3, distribution, width);
+    std::vector<unsigned int> pixels(3 * stride);
+    convert_to_int(rgba.data(), stride, 3, 4, pixels.data());
+    const unsigned int* upper = &pixels[1];
+    const unsigned int* current = upper + stride;
+    const unsigned int* lower = current + stride;
+    std::string suffix = std::string(" width ") + std::to_string(width) + " " + distribution_name(distribution);
+
+    std::vector<unsigned char> luma_rows(3 * stride);
+    luma_row_scalar(pixels.data(), luma_rows.data(), 3 * stride);
+    for (auto [name, kernel] : vector_kernels<LumaRow>(luma_row_sse2, luma_row_avx2)) {
+        std::vector<unsigned char> vector_luma(3 * stride);
+        kernel(pixels.data(), vector_luma.data(), 3 * stride);
+        log.expect_equal(std::string("luma ") + name + suffix, luma_rows, vector_luma);
+    }
+
+    std::vector<unsigned short> expected(width), actual(width);
+    color_energy_row_scalar(expected.data(), upper, current, lower, width);
+    for (auto [name, kernel] : vector_kernels<ColorEnergyRow>(color_energy_row_sse2, color_energy_row_avx2)) {
+        std::fill(actual.begin(), actual.end(), 0);
+        kernel(actual.data(), upper, current, lower, width);
+        log.expect_equal(std::string("color ") + name + suffix, expected, actual);
+    }
+
+    const unsigned char* upper_luma = &luma_rows[1];
+    const unsigned char* current_luma = upper_luma + stride;
+    forward_energy_row_scalar(expected.data(), current_luma, width);
+    for (auto [name, kernel] : vector_kernels<ForwardEnergyRow>(forward_energy_row_sse2, forward_energy_row_avx2)) {
+        std::fill(actual.begin(), actual.end(), 0);
+        kernel(actual.data(), current_luma, width);
+        log.expect_equal(std::string("forward ") + name + suffix, expected, actual);
+    }
+
+    forward_diagonal_row_scalar(expected.data(), upper_luma, current_luma, width);
+    for (auto [name, kernel] : vector_kernels<ForwardDiagonalRow>(forward_diagonal_row_sse2, forward_diagonal_row_avx2)) {
+        std::fill(actual.begin(), actual.end(), 0);
+        kernel(actual.data(), upper_luma, current_luma, width);
+        log.expect_equal(std::string("forward diagonal ") + name + suffix, expected, actual);
+    }
+#endif
+}
+
+//The map of one sweep against the strips and diagonal costs recalculate_energy_at_seam() computes pixel by pixel
+template <typename Energy>
+void check_sweep(CheckLog& log, EnergyKind kind, const std::vector<unsigned int>& pixels, int width, int height, const std::string& suffix) {
+    std::vector<unsigned int> img = pixels;
+    std::vector<unsigned short> energy(img.size()), diagonal(img.size());
+    generate_energy_map(energy, img.data(), width, height, width, kind, diagonal.data());
+
+    std::vector<unsigned short> expected = energy;
+    for (int y = 1; y < height - 1 && width >= 3; y++) {
+        Energy::strip(&expected[compute_offset(0, y, width, 1)], img.data(), width, y, 1, width - 2);
+    }
+    log.expect_equal(std::string(energy_name(kind)) + " sweep" + suffix, expected, energy);
+
+    if constexpr (Energy::diagonal_costs) {
+        std::vector<unsigned short> expected_diagonal = diagonal;
+        for (int y = 1; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                expected_diagonal[compute_offset(x, y, width, 1)] = Energy::diagonal_at(x, y, width, img.data(), width);
+            }
+        }
+        log.expect_equal(std::string(energy_name(kind)) + " diagonal sweep" + suffix, expected_diagonal, diagonal);
+    }
+}
+
+//Every policy of energy_registry
+void check_sweeps(CheckLog& log, const std::vector<unsigned int>& pixels, int width, int height, const std::string& suffix) {
+    check_sweep<GradientEnergy>(log, EnergyKind::gradient, pixels, width, height, suffix);
+    check_sweep<ColorEnergy>(log, EnergyKind::color, pixels, width, height, suffix);
+    check_sweep<ForwardEnergy>(log, EnergyKind::forward, pixels, width, height, suffix);
+    check_sweep<SobelEnergy>(log, EnergyKind::sobel, pixels, width, height, suffix);
+    check_sweep<ScharrEnergy>(log, EnergyKind::scharr, pixels, width, height, suffix);
+    check_sweep<LaplacianEnergy>(log, EnergyKind::laplacian, pixels, width, height, suffix);
+    check_sweep<EntropyEnergy>(log, EnergyKind::entropy, pixels, width, height, suffix);
+}
+
+//Maps kept up to date over removed seams against the maps of the carved image, seam by seam and in batches
+void check_recalculation(CheckLog& log, EnergyKind kind, const std::vector<unsigned char>& rgba, int width, int height, const std::string& suffix) {
+    for (bool batched : {false, true}) {
+        CarveWorkspace workspace;
+        workspace.energy_kind = kind;
+        prepare_carve_rgba(rgba.data(), width, height, workspace);
+        int carved_width = width;
+        int remove = std::min(width - 1, 12);
+        if (!batched) {
+            carve_prepared(workspace.pixels.data(), carved_width, height, width, remove, 8, workspace);
+        }
+        else {
+            workspace.seams.resize(width);
+            while (carved_width > width - remove) {
+                workspace.seam_weights.assign(carved_width, 0);
+                generate_seams(workspace.seams, workspace.seam_weights, workspace.energy, carved_width, height, width, 8, nullptr,
+                               workspace.diagonal_map());
+                int removed = remove_seams_batch(workspace.pixels.data(), workspace.seams, workspace.seam_weights, workspace.energy, carved_width,
+                                                 height, width, std::min(4, carved_width - (width - remove)), kind, workspace.diagonal_map());
+                if (removed == 0) {
+                    break;
+                }
+            }
+        }
+
+        std::vector<unsigned int> carved(static_cast<size_t>(carved_width) * height);
+        std::vector<unsigned short> energy(carved.size()), diagonal(carved.size());
+        std::vector<unsigned short> expected(carved.size()), expected_diagonal(carved.size());
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < carved_width; x++) {
+                carved[compute_offset(x, y, carved_width, 1)] = workspace.pixels[compute_offset(x, y, width, 1)];
+                energy[compute_offset(x, y, carved_width, 1)] = workspace.energy[compute_offset(x, y, width, 1)];
+                if (!workspace.diagonal.empty()) {
+                    diagonal[compute_offset(x, y, carved_width, 1)] = workspace.diagonal[compute_offset(x, y, width, 1)];
+                }
+            }
+        }
+        generate_energy_map(expected, carved.data(), carved_width, height, carved_width, kind, expected_diagonal.data());
+        //The first and last row are only written by the sweep, the recalculation leaves them as they were
+        for (int y : {0, height - 1}) {
+            std::copy_n(&expected[compute_offset(0, y, carved_width, 1)], carved_width, &energy[compute_offset(0, y, carved_width, 1)]);
+        }
+        std::string what = std::string(energy_name(kind)) + (batched ? " batched" : " seam by seam") + suffix;
+        log.expect_equal(what, expected, energy);
+        if (!workspace.diagonal.empty()) {
+            log.expect_equal(what + " diagonal", expected_diagonal, diagonal);
+        }
+    }
+}
+
+//Runs every check and reports how many failed; true if none did
+bool run_checks() {
+    CheckLog log;
+    for (Distribution distribution : check_distributions) {
+        for (int width : check_widths) {
+            check_row_kernels(log, width, distribution);
+            for (int height : check_heights) {
+                std::string suffix = std::string(" ") + std::to_string(width) + "x" + std::to_string(height) + " " + distribution_name(distribution);
+                std::vector<unsigned char> rgba = synthetic_rgba(width, height, distribution, width * 31 + height);
+                std::vector<unsigned int> pixels(rgba.size() / 4);
+                convert_to_int(rgba.data(), width, height, 4, pixels.data());
+                check_sweeps(log, pixels, width, height, suffix);
+                for (int kind = 0; kind < energy_kind_count; kind++) {
+                    check_recalculation(log, static_cast<EnergyKind>(kind), rgba, width, height, suffix);
+                }
+            }
+        }
+    }
+    printf("%d of %d checks failed\n", log.failures, log.checks);
+    return log.failures == 0;
+}
+
+#endif //SEAMCARVING_CHECK_H
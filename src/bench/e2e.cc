@@ -0,0 +1,376 @@
+#include "../headers/main.h"
+#include "synthetic.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <spawn.h>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef SEAMCARVING_BINARY
+#define SEAMCARVING_BINARY "SeamCarving"
+#endif
+
+extern char** environ;
+
+struct E2ESettings {
+    std::string binary = SEAMCARVING_BINARY;
+    std::string corpus = "seamcarving_corpus";
+    std::vector<std::pair<int, int>> sizes = {{640, 480}, {1280, 960}, {1920, 1440}};
+    std::vector<Distribution> contents = {Distribution::gradient, Distribution::texture, Distribution::regions, Distribution::edges};
+    std::vector<int> reductions = {10, 30, 60};
+    int repeat = 3;
+    int seam_count = 100;
+    std::string csv;
+    std::string json;
+    std::string baseline;
+    double tolerance = 10;
+};
+
+//One carve of the corpus, measured over settings.repeat runs
+struct E2EResult {
+    std::string content;
+    int width = 0;
+    int height = 0;
+    int reduction = 0;
+    int removed = 0;
+    //Median wall time of the runs, process start to exit
+    double wall_ms = 0;
+    //Largest resident set of the runs
+    long peak_rss_kb = 0;
+    double seams_per_second = 0;
+    double megapixels_per_second = 0;
+    bool ok = true;
+
+    std::string key() const {
+        return content + " " + std::to_string(width) + "x" + std::to_string(height) + " " + std::to_string(reduction) + "%";
+    }
+};
+
+//Writes the corpus image of content at width x height, unless an earlier run already did
+//The seed only depends on content and size, so every machine carves the same pixels.
+bool corpus_image(const std::string& corpus, Distribution content, int width, int height, std::string& path) {
+    path = (std::filesystem::path(corpus) / (std::string(distribution_name(content)) + "_" + std::to_string(width) + "x" + std::to_string(height) + ".png")).string();
+    if (std::filesystem::exists(path)) {
+        return true;
+    }
+    std::filesystem::create_directories(corpus);
+    uint64_t seed = (static_cast<uint64_t>(content) + 1) * 1000003 + static_cast<uint64_t>(width) * 8191 + height;
+    std::vector<unsigned char> rgba = synthetic_rgba(width, height, content, seed);
+    std::string temporary = path + ".tmp.png";
+    if (!stbi_write_png(temporary.c_str(), width, height, 4, rgba.data(), width * 4)) {
+        return false;
+    }
+    std::filesystem::rename(temporary, path);
+    return true;
+}
+
+//Runs the carver as its own process, so its peak RSS is that of a single carve
+bool run_carve(const E2ESettings& settings, const std::string& input, const std::string& output, int removed, double& wall_ms, long& peak_rss_kb) {
+    std::vector<std::string> arguments = {settings.binary, input, output, std::to_string(removed), std::to_string(settings.seam_count), "--quiet"};
+    std::vector<char*> argv;
+    for (auto& argument : arguments) {
+        argv.push_back(argument.data());
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    auto start = MetricsClock::now();
+    pid_t pid;
+    int error = posix_spawn(&pid, settings.binary.c_str(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) {
+        log_error() << "Error: cannot run " << settings.binary << ": " << strerror(error);
+        return false;
+    }
+    int status;
+    rusage usage{};
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        return false;
+    }
+    wall_ms = milliseconds_between(start, MetricsClock::now());
+    peak_rss_kb = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+E2EResult run_case(const E2ESettings& settings, Distribution content, int width, int height, int reduction) {
+    E2EResult result;
+    result.content = distribution_name(content);
+    result.width = width;
+    result.height = height;
+    result.reduction = reduction;
+    result.removed = std::min(width - 1, width * reduction / 100);
+
+    std::string input;
+    if (!corpus_image(settings.corpus, content, width, height, input)) {
+        log_error() << "Error: cannot write the corpus image " << input;
+        result.ok = false;
+        return result;
+    }
+    std::string output = (std::filesystem::path(settings.corpus) / "carved.png").string();
+
+    std::vector<double> times;
+    for (int i = 0; i < settings.repeat && result.ok; i++) {
+        double wall_ms = 0;
+        long peak_rss_kb = 0;
+        result.ok = run_carve(settings, input, output, result.removed, wall_ms, peak_rss_kb);
+        if (result.ok) {
+            times.push_back(wall_ms);
+            result.peak_rss_kb = std::max(result.peak_rss_kb, peak_rss_kb);
+        }
+    }
+    //A failed case reports 0 rather than the time of a run that did not finish
+    if (!result.ok || times.empty()) {
+        result.peak_rss_kb = 0;
+        return result;
+    }
+    std::sort(times.begin(), times.end());
+    result.wall_ms = times[times.size() / 2];
+    result.seams_per_second = result.wall_ms > 0 ? result.removed * 1000 / result.wall_ms : 0;
+    result.megapixels_per_second = result.wall_ms > 0 ? static_cast<double>(width) * height / (result.wall_ms * 1000) : 0;
+    return result;
+}
+
+const char* e2e_csv_header = "content,width,height,reduction,removed,wall_ms,peak_rss_kb,seams_per_second,megapixels_per_second,ok";
+
+bool write_csv(const std::string& path, const std::vector<E2EResult>& results) {
+    std::ofstream file(path);
+    file << e2e_csv_header << "\n";
+    for (auto& result : results) {
+        file << result.content << "," << result.width << "," << result.height << "," << result.reduction << "," << result.removed << ","
+             << result.wall_ms << "," << result.peak_rss_kb << "," << result.seams_per_second << "," << result.megapixels_per_second << ","
+             << (result.ok ? 1 : 0) << "\n";
+    }
+    return static_cast<bool>(file.flush());
+}
+
+bool write_json(const std::string& path, const std::vector<E2EResult>& results) {
+    std::ofstream file(path);
+    file << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& result = results[i];
+        file << "  {\"content\": \"" << result.content << "\", \"width\": " << result.width << ", \"height\": " << result.height
+             << ", \"reduction\": " << result.reduction << ", \"removed\": " << result.removed << ", \"wall_ms\": " << result.wall_ms
+             << ", \"peak_rss_kb\": " << result.peak_rss_kb << ", \"seams_per_second\": " << result.seams_per_second
+             << ", \"megapixels_per_second\": " << result.megapixels_per_second << ", \"ok\": " << (result.ok ? "true" : "false")
+             << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "]\n";
+    return static_cast<bool>(file.flush());
+}
+
+//Reads a baseline written with --csv
+bool read_baseline(const std::string& path, std::map<std::string, E2EResult>& baseline) {
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line) || line != e2e_csv_header) {
+        return false;
+    }
+    while (std::getline(file, line)) {
+        std::stringstream stream(line);
+        std::vector<std::string> fields;
+        std::string field;
+        while (std::getline(stream, field, ',')) {
+            fields.push_back(field);
+        }
+        if (fields.size() != 10) {
+            return false;
+        }
+        E2EResult result;
+        try {
+            result.content = fields[0];
+            result.width = std::stoi(fields[1]);
+            result.height = std::stoi(fields[2]);
+            result.reduction = std::stoi(fields[3]);
+            result.removed = std::stoi(fields[4]);
+            result.wall_ms = std::stod(fields[5]);
+            result.peak_rss_kb = std::stol(fields[6]);
+            result.seams_per_second = std::stod(fields[7]);
+            result.megapixels_per_second = std::stod(fields[8]);
+            result.ok = fields[9] == "1";
+        } catch (std::exception& exception) {
+            return false;
+        }
+        baseline[result.key()] = result;
+    }
+    return true;
+}
+
+//Prints every case slower or larger than the baseline by more than tolerance percent; returns how many there are
+int compare_to_baseline(const std::vector<E2EResult>& results, const std::map<std::string, E2EResult>& baseline, double tolerance) {
+    int regressions = 0;
+    auto check = [&](const E2EResult& result, const char* what, double now, double before) {
+        double change = before > 0 ? 100 * (now - before) / before : 0;
+        if (change > tolerance) {
+            std::cout << "Regression: " << result.key() << ": " << what << " " << now << " against " << before << " (+" << change << "%)" << std::endl;
+            regressions++;
+        }
+    };
+    for (auto& result : results) {
+        auto found = baseline.find(result.key());
+        if (found == baseline.end()) {
+            std::cout << "Not in the baseline: " << result.key() << std::endl;
+            continue;
+        }
+        check(result, "wall ms", result.wall_ms, found->second.wall_ms);
+        check(result, "peak RSS kB", static_cast<double>(result.peak_rss_kb), static_cast<double>(found->second.peak_rss_kb));
+    }
+    return regressions;
+}
+
+std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+void print_usage() {
+    std::cout << "seamcarving_e2e [options]" << std::endl << std::endl;
+    std::cout << "Carves a generated corpus end to end with the SeamCarving binary and records wall time, peak RSS and throughput." << std::endl << std::endl;
+    std::cout << "--binary PATH\t\tCarver to run, defaults to the one built alongside." << std::endl;
+    std::cout << "--corpus DIR\t\tWhere the corpus images are generated and kept, default seamcarving_corpus." << std::endl;
+    std::cout << "--sizes WxH,...\t\tCorpus resolutions, default 640x480,1280x960,1920x1440." << std::endl;
+    std::cout << "--contents C,...\tAny of gradient, texture, regions, edges, natural, noise and flat, default the first four." << std::endl;
+    std::cout << "--reductions P,...\tWidth reductions in percent, default 10,30,60." << std::endl;
+    std::cout << "--repeat N\t\tRuns per carve, the median wall time counts, default 3." << std::endl;
+    std::cout << "--seams N\t\t<number of seams> passed to the carver, default 100." << std::endl;
+    std::cout << "--csv PATH\t\tWrite the results as CSV, which also serves as a baseline." << std::endl;
+    std::cout << "--json PATH\t\tWrite the results as JSON." << std::endl;
+    std::cout << "--baseline PATH\t\tCSV of an earlier run; exit with 1 if wall time or peak RSS of a carve grew by more than" << std::endl;
+    std::cout << "\t\t\t--tolerance percent (default 10)." << std::endl;
+}
+
+bool parse_e2e_options(int argc, char* argv[], E2ESettings& settings) {
+    for (int i = 1; i < argc; i++) {
+        std::string key(argv[i]);
+        if (key == "--help" || key == "-h") {
+            return false;
+        }
+        if (i + 1 >= argc) {
+            std::cout << "Error: " << key << " needs a value" << std::endl;
+            return false;
+        }
+        std::string value(argv[++i]);
+        try {
+            if (key == "--binary") {
+                settings.binary = value;
+            }
+            else if (key == "--corpus") {
+                settings.corpus = value;
+            }
+            else if (key == "--sizes") {
+                settings.sizes.clear();
+                for (auto& size : split_list(value)) {
+                    size_t x = size.find('x');
+                    if (x == std::string::npos) {
+                        std::cout << "Error: sizes are given as WxH" << std::endl;
+                        return false;
+                    }
+                    settings.sizes.emplace_back(std::max(3, std::stoi(size.substr(0, x))), std::max(3, std::stoi(size.substr(x + 1))));
+                }
+            }
+            else if (key == "--contents") {
+                settings.contents.clear();
+                for (auto& name : split_list(value)) {
+                    Distribution content;
+                    if (!parse_distribution(name, content)) {
+                        std::cout << "Error: unknown content " << name << std::endl;
+                        return false;
+                    }
+                    settings.contents.push_back(content);
+                }
+            }
+            else if (key == "--reductions") {
+                settings.reductions.clear();
+                for (auto& reduction : split_list(value)) {
+                    settings.reductions.push_back(std::clamp(std::stoi(reduction), 0, 99));
+                }
+            }
+            else if (key == "--repeat") {
+                settings.repeat = std::max(1, std::stoi(value));
+            }
+            else if (key == "--seams") {
+                settings.seam_count = std::max(1, std::stoi(value));
+            }
+            else if (key == "--csv") {
+                settings.csv = value;
+            }
+            else if (key == "--json") {
+                settings.json = value;
+            }
+            else if (key == "--baseline") {
+                settings.baseline = value;
+            }
+            else if (key == "--tolerance") {
+                settings.tolerance = std::stod(value);
+            }
+            else {
+                std::cout << "Error: unknown option " << key << std::endl;
+                return false;
+            }
+        } catch (std::invalid_argument& invalidArgument) {
+            std::cout << "Error: invalid number for " << key << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    E2ESettings settings;
+    if (!parse_e2e_options(argc, argv, settings)) {
+        print_usage();
+        return 1;
+    }
+    std::map<std::string, E2EResult> baseline;
+    if (!settings.baseline.empty() && !read_baseline(settings.baseline, baseline)) {
+        std::cout << "Error: cannot read the baseline " << settings.baseline << std::endl;
+        return 1;
+    }
+
+    std::vector<E2EResult> results;
+    int failures = 0;
+    printf("%-9s %-11s %6s %8s %10s %12s %10s %8s\n", "content", "size", "reduce", "removed", "wall ms", "peak RSS kB", "seams/s", "MP/s");
+    for (auto& [width, height] : settings.sizes) {
+        for (Distribution content : settings.contents) {
+            for (int reduction : settings.reductions) {
+                E2EResult result = run_case(settings, content, width, height, reduction);
+                std::string size = std::to_string(width) + "x" + std::to_string(height);
+                printf("%-9s %-11s %5d%% %8d %10.1f %12ld %10.1f %8.2f%s\n", result.content.c_str(), size.c_str(), reduction, result.removed,
+                       result.wall_ms, result.peak_rss_kb, result.seams_per_second, result.megapixels_per_second, result.ok ? "" : "  FAILED");
+                fflush(stdout);
+                failures += result.ok ? 0 : 1;
+                results.push_back(result);
+            }
+        }
+    }
+
+    if (!settings.csv.empty() && !write_csv(settings.csv, results)) {
+        std::cout << "Error: cannot write " << settings.csv << std::endl;
+        return 1;
+    }
+    if (!settings.json.empty() && !write_json(settings.json, results)) {
+        std::cout << "Error: cannot write " << settings.json << std::endl;
+        return 1;
+    }
+    int regressions = settings.baseline.empty() ? 0 : compare_to_baseline(results, baseline, settings.tolerance);
+    if (failures > 0 || regressions > 0) {
+        std::cout << failures << " carves failed, " << regressions << " regressions beyond " << settings.tolerance << "%" << std::endl;
+        return 1;
+    }
+    return 0;
+}
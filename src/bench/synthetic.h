@@ -0,0 +1,203 @@
+#ifndef SEAMCARVING_SYNTHETIC_H
+#define SEAMCARVING_SYNTHETIC_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Kinds of content a synthetic image is made of, as far as the energy map is concerned
+//flat: one colour, next to no energy; noise: random pixels, high energy everywhere;
+//natural: smooth gradients with a few hard edges and some grain, energy clustered like in a photo;
+//gradient: smooth colour ramps without grain; texture: a fine repeating pattern with grain;
+//regions: a few large uniform areas, energy only along their borders; edges: dense thin lines at many angles
+enum class Distribution {
+    flat,
+    noise,
+    natural,
+    gradient,
+    texture,
+    regions,
+    edges
+};
+
+const int distribution_count = 7;
+
+const char* distribution_name(Distribution distribution) {
+    const char* names[distribution_count] = {"flat", "noise", "natural", "gradient", "texture", "regions", "edges"};
+    return names[static_cast<int>(distribution)];
+}
+
+bool parse_distribution(const std::string& name, Distribution& distribution) {
+    for (int i = 0; i < distribution_count; i++) {
+        if (name == distribution_name(static_cast<Distribution>(i))) {
+            distribution = static_cast<Distribution>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+//splitmix64, so the same seed gives the same image on every platform
+class SyntheticRandom {
+public:
+    explicit SyntheticRandom(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    //Uniform in [0, bound)
+    int below(int bound) {
+        return static_cast<int>(next() % static_cast<uint64_t>(bound));
+    }
+
+private:
+    uint64_t state;
+};
+
+unsigned char clamp_channel(double value) {
+    return static_cast<unsigned char>(std::lround(std::fmin(255.0, std::fmax(0.0, value))));
+}
+
+//Content of the patterned distributions, gradient, texture, regions and edges
+void fill_pattern(std::vector<unsigned char>& rgba, int width, int height, Distribution distribution, SyntheticRandom& random) {
+    //Centres of the regions, every pixel takes the colour of the nearest one
+    struct Centre {
+        int x, y;
+        unsigned char red, green, blue;
+    };
+    std::vector<Centre> centres(6);
+    for (auto& centre : centres) {
+        centre = {random.below(width), random.below(height), static_cast<unsigned char>(random.below(256)),
+                  static_cast<unsigned char>(random.below(256)), static_cast<unsigned char>(random.below(256))};
+    }
+    int period = 4 + random.below(5);
+
+    for (int y = 0; y < height; y++) {
+        double v = static_cast<double>(y) / height;
+        for (int x = 0; x < width; x++) {
+            double u = static_cast<double>(x) / width;
+            double red, green, blue;
+            if (distribution == Distribution::gradient) {
+                red = 255 * u;
+                green = 255 * v;
+                blue = 255 * (1 - u) * (1 - v);
+            }
+            else if (distribution == Distribution::texture) {
+                double weave = std::sin(6.28 * x / period) * std::sin(6.28 * y / period);
+                double grain = static_cast<int>(random.next() & 31) - 15.5;
+                red = 140 + 60 * weave + grain;
+                green = 110 + 50 * weave + grain;
+                blue = 80 + 40 * weave + grain;
+            }
+            else if (distribution == Distribution::regions) {
+                const Centre* nearest = &centres[0];
+                long long nearest_distance = -1;
+                for (auto& centre : centres) {
+                    long long distance = static_cast<long long>(x - centre.x) * (x - centre.x) + static_cast<long long>(y - centre.y) * (y - centre.y);
+                    if (nearest_distance < 0 || distance < nearest_distance) {
+                        nearest = &centre;
+                        nearest_distance = distance;
+                    }
+                }
+                red = nearest->red;
+                green = nearest->green;
+                blue = nearest->blue;
+            }
+            else {
+                //Stripes one to two pixels wide, their direction changing from tile to tile
+                int tile = (x / 64) * 7 + (y / 64) * 13;
+                int direction = tile % 4;
+                int coordinate = direction == 0 ? x : direction == 1 ? y : direction == 2 ? x + y : x - y + height;
+                bool line = coordinate % (2 + tile % 3) == 0;
+                red = green = blue = line ? 20 : 235;
+            }
+            size_t position = (static_cast<size_t>(y) * width + x) * 4;
+            rgba[position] = clamp_channel(red);
+            rgba[position + 1] = clamp_channel(green);
+            rgba[position + 2] = clamp_channel(blue);
+            rgba[position + 3] = 255;
+        }
+    }
+}
+
+//RGBA pixels, 4 bytes each, of a width x height image
+std::vector<unsigned char> synthetic_rgba(int width, int height, Distribution distribution, uint64_t seed) {
+    std::vector<unsigned char> rgba(static_cast<size_t>(width) * height * 4);
+    SyntheticRandom random(seed);
+
+    if (distribution == Distribution::flat) {
+        unsigned char red = 64 + random.below(128), green = 64 + random.below(128), blue = 64 + random.below(128);
+        for (size_t i = 0; i < rgba.size(); i += 4) {
+            rgba[i] = red;
+            rgba[i + 1] = green;
+            rgba[i + 2] = blue;
+            rgba[i + 3] = 255;
+        }
+        return rgba;
+    }
+
+    if (distribution == Distribution::noise) {
+        for (size_t i = 0; i < rgba.size(); i += 4) {
+            uint64_t bits = random.next();
+            rgba[i] = bits & 0xFF;
+            rgba[i + 1] = (bits >> 8) & 0xFF;
+            rgba[i + 2] = (bits >> 16) & 0xFF;
+            rgba[i + 3] = 255;
+        }
+        return rgba;
+    }
+
+    if (distribution != Distribution::natural) {
+        fill_pattern(rgba, width, height, distribution, random);
+        return rgba;
+    }
+
+    //Rectangles with hard edges over a smooth background, like objects in front of sky and ground
+    struct Block {
+        int left, top, right, bottom;
+        double red, green, blue;
+    };
+    std::vector<Block> blocks(12);
+    for (auto& block : blocks) {
+        block.left = random.below(width);
+        block.top = random.below(height);
+        block.right = std::min(width, block.left + 1 + random.below(std::max(1, width / 4)));
+        block.bottom = std::min(height, block.top + 1 + random.below(std::max(1, height / 3)));
+        block.red = random.below(256);
+        block.green = random.below(256);
+        block.blue = random.below(256);
+    }
+    double phase = random.below(628) / 100.0;
+
+    for (int y = 0; y < height; y++) {
+        double v = static_cast<double>(y) / height;
+        for (int x = 0; x < width; x++) {
+            double u = static_cast<double>(x) / width;
+            double red = 90 + 80 * v + 30 * std::sin(6.28 * u + phase);
+            double green = 120 + 60 * std::sin(3.14 * v + 2 * u);
+            double blue = 200 - 120 * v;
+            for (auto& block : blocks) {
+                if (x >= block.left && x < block.right && y >= block.top && y < block.bottom) {
+                    red = block.red;
+                    green = block.green;
+                    blue = block.blue;
+                }
+            }
+            double grain = static_cast<int>(random.next() & 15) - 7.5;
+            size_t position = (static_cast<size_t>(y) * width + x) * 4;
+            rgba[position] = clamp_channel(red + grain);
+            rgba[position + 1] = clamp_channel(green + grain);
+            rgba[position + 2] = clamp_channel(blue + grain);
+            rgba[position + 3] = 255;
+        }
+    }
+    return rgba;
+}
+
+#endif //SEAMCARVING_SYNTHETIC_H
@@ -0,0 +1,108 @@
+#ifndef SEAMCARVING_ALLOCATIONS_H
+#define SEAMCARVING_ALLOCATIONS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <malloc.h>
+
+//Process wide allocation totals, counted from start_allocation_tracking() on
+//Sizes are malloc_usable_size(), so a block is counted the same when it is freed through any of the hooks.
+struct AllocationCounters {
+    std::atomic<bool> enabled{false};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> live{0};
+    //Highest live since the last take_window_peak(), and since tracking started
+    std::atomic<int64_t> window_peak{0};
+    std::atomic<int64_t> peak{0};
+};
+
+AllocationCounters allocation_counters;
+
+void raise_to(std::atomic<int64_t>& peak, int64_t value) {
+    int64_t current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+//Put in front of every block the hooks hand out, so that freeing a block only lowers the live bytes if allocating it
+//raised them; blocks from before start_allocation_tracking() were never counted.
+struct alignas(std::max_align_t) BlockHeader {
+    bool tracked;
+};
+
+//Counts a block fresh from malloc() or realloc() and returns the memory after its header
+void* record_allocation(void* base) {
+    if (base == nullptr) {
+        return nullptr;
+    }
+    auto* header = static_cast<BlockHeader*>(base);
+    header->tracked = allocation_counters.enabled.load(std::memory_order_relaxed);
+    if (header->tracked) {
+        int64_t size = static_cast<int64_t>(malloc_usable_size(base));
+        allocation_counters.count.fetch_add(1, std::memory_order_relaxed);
+        allocation_counters.bytes.fetch_add(size, std::memory_order_relaxed);
+        int64_t live = allocation_counters.live.fetch_add(size, std::memory_order_relaxed) + size;
+        raise_to(allocation_counters.window_peak, live);
+        raise_to(allocation_counters.peak, live);
+    }
+    return header + 1;
+}
+
+BlockHeader* block_header(void* block) {
+    return static_cast<BlockHeader*>(block) - 1;
+}
+
+void record_free(BlockHeader* header) {
+    if (header->tracked) {
+        allocation_counters.live.fetch_sub(static_cast<int64_t>(malloc_usable_size(header)), std::memory_order_relaxed);
+    }
+}
+
+void start_allocation_tracking() {
+    allocation_counters.enabled.store(true, std::memory_order_relaxed);
+}
+
+bool allocations_tracked() {
+    return allocation_counters.enabled.load(std::memory_order_relaxed);
+}
+
+//Peak live bytes since the previous call, starting the next window at the current live bytes
+int64_t take_window_peak() {
+    return allocation_counters.window_peak.exchange(allocation_counters.live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+//malloc()/realloc()/free() of stb and of every image buffer the carver passes around
+void* tracked_malloc(size_t size) {
+    return record_allocation(malloc(sizeof(BlockHeader) + size));
+}
+
+//A block that moves or grows counts as freed and allocated again
+void* tracked_realloc(void* block, size_t size) {
+    if (block == nullptr) {
+        return tracked_malloc(size);
+    }
+    BlockHeader* header = block_header(block);
+    bool tracked = header->tracked;
+    int64_t old_size = static_cast<int64_t>(malloc_usable_size(header));
+    void* moved = realloc(header, sizeof(BlockHeader) + size);
+    if (moved == nullptr) {
+        return nullptr;
+    }
+    if (tracked) {
+        allocation_counters.live.fetch_sub(old_size, std::memory_order_relaxed);
+    }
+    return record_allocation(moved);
+}
+
+void tracked_free(void* block) {
+    if (block == nullptr) {
+        return;
+    }
+    record_free(block_header(block));
+    free(block_header(block));
+}
+
+#endif //SEAMCARVING_ALLOCATIONS_H
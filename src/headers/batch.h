@@ -0,0 +1,177 @@
+#ifndef SEAMCARVING_BATCH_H
+#define SEAMCARVING_BATCH_H
+
+#include "main.h"
+#include "batch_io.h"
+#include "scheduler.h"
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <string>
+
+struct BatchOptions {
+    int remove = 0;
+    int seam_count = 100;
+    int threads = 1;
+    //Number of inputs read ahead of the workers, also the number of registered read buffers
+    int queue_depth = 8;
+    size_t buffer_size = 16 << 20;
+    bool use_uring = true;
+    //Upper bound for the summed predicted peak memory of the carves running at once
+    size_t memory_budget = default_memory_budget();
+};
+
+//Where the carve of input goes: <output dir>/<input name>.png
+std::string batch_output_path(const std::string& out_dir, const std::string& input) {
+    return (std::filesystem::path(out_dir) / std::filesystem::path(input).stem()).string() + ".png";
+}
+
+//Carves every input and writes <output dir>/<input name>.png
+//Reads of upcoming inputs and writes of finished outputs go through an IoBackend so workers never wait on disk.
+//Inputs are carved shortest predicted job first, with as many at once as the memory budget allows.
+int run_batch(const std::vector<std::string>& paths, const std::string& out_dir, const BatchOptions& options) {
+    std::unique_ptr<IoBackend> io = make_io_backend(options.queue_depth, options.buffer_size, options.use_uring);
+    log_info() << "Batch of " << paths.size() << " images, " << options.threads << " workers, " << io->name() << " I/O";
+
+    JobScheduler scheduler(options.memory_budget, options.threads);
+    std::vector<std::string> inputs;
+    std::vector<JobCost> costs;
+    std::vector<std::pair<JobCost, std::string>> planned;
+    int failures = 0;
+
+    //Only the image headers are read here, unreadable ones are left for the decoder to report
+    //Inputs whose output would overwrite that of an earlier one (a/img.png and b/img.png, img.jpg and img.png) fail.
+    std::map<std::string, std::string> outputs;
+    for (auto& path : paths) {
+        auto [claimed, unique] = outputs.emplace(batch_output_path(out_dir, path), path);
+        if (!unique) {
+            log_error() << "Error: " << path << ": writes to " << claimed->first << " like " << claimed->second;
+            failures++;
+            continue;
+        }
+        int width, height, channels;
+        JobCost cost;
+        if (stbi_info(path.c_str(), &width, &height, &channels)) {
+            cost = estimate_job_cost(width, height, options.remove, options.seam_count, default_energy_kind);
+        }
+        if (!scheduler.fits_budget(cost)) {
+            log_error() << "Error: " << path << ": needs " << (cost.peak_bytes >> 20) << " MiB, over the memory budget";
+            failures++;
+            continue;
+        }
+        planned.emplace_back(cost, path);
+    }
+    std::stable_sort(planned.begin(), planned.end(), [](auto& a, auto& b) { return a.first.cpu_ms < b.first.cpu_ms; });
+    for (auto& [cost, path] : planned) {
+        costs.push_back(cost);
+        inputs.push_back(path);
+    }
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t next_input = 0;
+    size_t completed = 0;
+
+    auto job_done = [&](const std::string& path, const char* error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error != nullptr) {
+            log_error() << "Error: " << path << ": " << error;
+            failures++;
+        }
+        completed++;
+        if (completed == inputs.size()) {
+            finished.notify_all();
+        }
+    };
+
+    ThreadPool workers(options.threads);
+    std::function<void()> read_next;
+
+    auto process = [&](size_t index, IoBuffer buffer) {
+        //Keep the read-ahead window full while this one is being carved
+        read_next();
+
+        const std::string& path = inputs[index];
+        TraceSpan wait_span("wait_for_memory");
+        scheduler.acquire(costs[index]);
+        wait_span.end();
+
+        int width, height, channels;
+        TraceSpan decode_span("decode");
+        unsigned char* raw_img = stbi_load_from_memory(buffer.data, static_cast<int>(buffer.size), &width, &height, &channels, 4);
+        io->release(buffer);
+        decode_span.end();
+        if (raw_img == nullptr) {
+            scheduler.release(costs[index]);
+            job_done(path, stbi_failure_reason());
+            return;
+        }
+
+        int n = std::min(options.remove, width - 1);
+        TraceSpan convert_span("convert");
+        CarveWorkspace workspace;
+        prepare_carve_rgba(raw_img, width, height, workspace);
+        stbi_image_free(raw_img);
+        convert_span.end();
+
+        unsigned int* img = workspace.pixels.data();
+        int raw_width = width;
+        carve_prepared(img, width, height, raw_width, n, options.seam_count, workspace);
+        TraceSpan encode_span("encode");
+        img = compacted_copy(img, width, height, raw_width);
+        workspace = CarveWorkspace();
+        raw_img = convert_to_char(img, width, height, 4);
+        tracked_free(img);
+
+        int png_size = 0;
+        unsigned char* png = stbi_write_png_to_mem(raw_img, width * 4, width, height, 4, &png_size);
+        tracked_free(raw_img);
+        encode_span.end();
+        scheduler.release(costs[index]);
+        if (png == nullptr) {
+            job_done(path, "encoding failed");
+            return;
+        }
+
+        std::string out = batch_output_path(out_dir, path);
+        io->write_file(out, png, png_size, [&, out](int error) {
+            job_done(out, error != 0 ? strerror(error) : nullptr);
+        });
+    };
+
+    read_next = [&] {
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (next_input >= inputs.size()) {
+                return;
+            }
+            index = next_input++;
+        }
+        io->read_file(inputs[index], [&, index](int error, IoBuffer buffer) {
+            if (error != 0) {
+                job_done(inputs[index], strerror(error));
+                read_next();
+                return;
+            }
+            workers.submit([&, index, buffer = std::move(buffer)]() mutable {
+                process(index, std::move(buffer));
+            });
+        });
+    };
+
+    for (int i = 0; i < options.queue_depth; i++) {
+        read_next();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return completed == inputs.size(); });
+    }
+    workers.wait_idle();
+
+    log_info() << "Batch done: " << paths.size() - failures << " written, " << failures << " failed";
+    return failures == 0 ? 0 : 1;
+}
+
+#endif //SEAMCARVING_BATCH_H
@@ -0,0 +1,628 @@
+#ifndef SEAMCARVING_BATCH_IO_H
+#define SEAMCARVING_BATCH_IO_H
+
+#include "log.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+//Bytes of a file read by an IoBackend
+//Buffers living in a registered slot must be handed back through IoBackend::release() once decoded
+struct IoBuffer {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    int slot = -1;
+    std::vector<unsigned char> heap;
+};
+
+using ReadCallback = std::function<void(int error, IoBuffer buffer)>;
+using WriteCallback = std::function<void(int error)>;
+
+//Asynchronous file access for batch mode
+//Completion callbacks run on the backend's own threads and should only hand the result over to a worker
+class IoBackend {
+public:
+    virtual ~IoBackend() = default;
+
+    virtual void read_file(const std::string& path, ReadCallback done) = 0;
+
+    //Takes ownership of data, which must have been allocated with tracked_malloc()
+    virtual void write_file(const std::string& path, unsigned char* data, size_t size, WriteCallback done) = 0;
+
+    virtual void release(IoBuffer& buffer) {
+        buffer.heap.clear();
+        buffer.heap.shrink_to_fit();
+        buffer.data = nullptr;
+    }
+
+    virtual const char* name() const = 0;
+};
+
+//Fallback backend doing plain blocking reads and writes on a dedicated pool of I/O threads
+class ThreadPoolBackend : public IoBackend {
+public:
+    explicit ThreadPoolBackend(int thread_count) : pool(thread_count) {}
+
+    void read_file(const std::string& path, ReadCallback done) override {
+        pool.submit([path, done = std::move(done)] {
+            IoBuffer buffer;
+            FILE* file = fopen(path.c_str(), "rb");
+            if (file == nullptr) {
+                done(errno, std::move(buffer));
+                return;
+            }
+
+            int error = 0;
+            if (fseek(file, 0, SEEK_END) == 0) {
+                long size = ftell(file);
+                rewind(file);
+                if (size < 0) {
+                    error = EIO;
+                }
+                else {
+                    buffer.heap.resize(size);
+                    if (fread(buffer.heap.data(), 1, size, file) != static_cast<size_t>(size)) {
+                        error = EIO;
+                    }
+                }
+            }
+            else {
+                error = errno;
+            }
+            fclose(file);
+
+            buffer.data = buffer.heap.data();
+            buffer.size = buffer.heap.size();
+            done(error, std::move(buffer));
+        });
+    }
+
+    void write_file(const std::string& path, unsigned char* data, size_t size, WriteCallback done) override {
+        pool.submit([path, data, size, done = std::move(done)] {
+            int error = 0;
+            FILE* file = fopen(path.c_str(), "wb");
+            if (file == nullptr) {
+                error = errno;
+            }
+            else {
+                if (fwrite(data, 1, size, file) != size) {
+                    error = EIO;
+                }
+                if (fclose(file) != 0 && error == 0) {
+                    error = errno;
+                }
+            }
+            tracked_free(data);
+            done(error);
+        });
+    }
+
+    const char* name() const override {
+        return "threads";
+    }
+
+private:
+    ThreadPool pool;
+};
+
+//io_uring backend talking to the kernel through the raw syscalls, so no liburing is needed
+//Reads that fit go into a set of registered buffers (IORING_OP_READ_FIXED) and are decoded straight from there.
+//A single I/O thread owns the ring; submitters only enqueue and poke an eventfd the ring keeps polled. Files are opened
+//and sized on a small pool beforehand, so path lookups never hold up the ring. Should io_uring_enter() fail, whatever
+//the kernel has not taken yet goes to blocking I/O threads, which then serve every later request as well.
+class UringBackend : public IoBackend {
+public:
+    //Returns nullptr if io_uring is not available (old kernel, seccomp filtered container, ...)
+    static std::unique_ptr<UringBackend> create(unsigned entries, int slot_count, size_t slot_size) {
+        std::unique_ptr<UringBackend> backend(new UringBackend());
+        if (!backend->setup(entries)) {
+            return nullptr;
+        }
+        backend->register_slots(slot_count, slot_size);
+        backend->io_thread = std::thread([b = backend.get()] { b->run(); });
+        return backend;
+    }
+
+    ~UringBackend() override {
+        open_pool.wait_idle();
+        if (io_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake();
+            io_thread.join();
+        }
+        if (slot_memory != nullptr) {
+            munmap(slot_memory, slot_total);
+        }
+        if (sqes != nullptr) {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_ring != nullptr && cq_ring != sq_ring) {
+            munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != nullptr) {
+            munmap(sq_ring, sq_ring_size);
+        }
+        if (wake_fd >= 0) {
+            close(wake_fd);
+        }
+        if (ring_fd >= 0) {
+            close(ring_fd);
+        }
+    }
+
+    void read_file(const std::string& path, ReadCallback done) override {
+        auto* op = new Operation();
+        op->writing = false;
+        op->path = path;
+        op->read_done = std::move(done);
+        open_pool.submit([this, op] { start(op); });
+    }
+
+    void write_file(const std::string& path, unsigned char* data, size_t size, WriteCallback done) override {
+        auto* op = new Operation();
+        op->writing = true;
+        op->path = path;
+        op->write_data = data;
+        op->size = size;
+        op->write_done = std::move(done);
+        open_pool.submit([this, op] { start(op); });
+    }
+
+    void release(IoBuffer& buffer) override {
+        if (buffer.slot >= 0) {
+            std::lock_guard<std::mutex> lock(slot_mutex);
+            free_slots.push_back(buffer.slot);
+            buffer.slot = -1;
+        }
+        IoBackend::release(buffer);
+    }
+
+    const char* name() const override {
+        return "io_uring";
+    }
+
+private:
+    struct Operation {
+        bool writing = false;
+        std::string path;
+        int fd = -1;
+        size_t size = 0;
+        size_t done_bytes = 0;
+        int slot = -1;
+        unsigned char* target = nullptr;
+        std::vector<unsigned char> heap;
+        unsigned char* write_data = nullptr;
+        iovec vec{};
+        ReadCallback read_done;
+        WriteCallback write_done;
+    };
+
+    //user_data of the eventfd poll, every other completion carries its Operation*
+    static constexpr __u64 wake_tag = 0;
+
+    UringBackend() = default;
+
+    static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    bool setup(unsigned entries) {
+        io_uring_params params{};
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_fd < 0) {
+            return false;
+        }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+
+        void* sq = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED) {
+            return false;
+        }
+        sq_ring = static_cast<unsigned char*>(sq);
+
+        if (single_mmap) {
+            cq_ring = sq_ring;
+        }
+        else {
+            void* cq = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if (cq == MAP_FAILED) {
+                return false;
+            }
+            cq_ring = static_cast<unsigned char*>(cq);
+        }
+
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void* s = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (s == MAP_FAILED) {
+            sqes = nullptr;
+            return false;
+        }
+        sqes = static_cast<io_uring_sqe*>(s);
+
+        sq_head = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq_ring + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq_ring + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq_ring + params.cq_off.cqes);
+        sq_entries = params.sq_entries;
+
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return wake_fd >= 0;
+    }
+
+    //Registered buffers are optional, without them (e.g. RLIMIT_MEMLOCK too low) every read goes to the heap
+    void register_slots(int slot_count, size_t size) {
+        if (slot_count <= 0 || size == 0) {
+            return;
+        }
+        slot_total = slot_count * size;
+        void* memory = mmap(nullptr, slot_total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            slot_memory = nullptr;
+            return;
+        }
+        slot_memory = static_cast<unsigned char*>(memory);
+
+        std::vector<iovec> vecs(slot_count);
+        for (int i = 0; i < slot_count; i++) {
+            vecs[i].iov_base = slot_memory + i * size;
+            vecs[i].iov_len = size;
+        }
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, vecs.data(), slot_count) < 0) {
+            munmap(slot_memory, slot_total);
+            slot_memory = nullptr;
+            return;
+        }
+
+        slot_size = size;
+        for (int i = slot_count - 1; i >= 0; i--) {
+            free_slots.push_back(i);
+        }
+    }
+
+    //Runs on the open pool: opens the file and queues the transfer for the ring, or for the fallback once there is one
+    void start(Operation* op) {
+        if (!open_operation(op)) {
+            return;
+        }
+        if (op->size == 0) {
+            finish(op, 0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (fallback == nullptr) {
+                pending.push_back(op);
+                op = nullptr;
+            }
+        }
+        if (op != nullptr) {
+            hand_over(op);
+            return;
+        }
+        wake();
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t written = write(wake_fd, &one, sizeof(one));
+    }
+
+    int take_slot() {
+        std::lock_guard<std::mutex> lock(slot_mutex);
+        if (free_slots.empty()) {
+            return -1;
+        }
+        int slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+
+    io_uring_sqe* next_sqe() {
+        unsigned tail = *sq_tail;
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+            return nullptr;
+        }
+        unsigned index = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        queued++;
+        return sqe;
+    }
+
+    void arm_wake_poll() {
+        io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = wake_fd;
+        sqe->poll_events = POLLIN;
+        sqe->user_data = wake_tag;
+    }
+
+    //Opens the file and sizes the transfer; returns false if the operation already failed
+    bool open_operation(Operation* op) {
+        if (op->writing) {
+            op->fd = open(op->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (op->fd < 0) {
+                finish(op, errno);
+                return false;
+            }
+            op->target = op->write_data;
+            return true;
+        }
+
+        op->fd = open(op->path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info{};
+        if (op->fd < 0 || fstat(op->fd, &info) != 0) {
+            finish(op, errno);
+            return false;
+        }
+        op->size = info.st_size;
+
+        if (op->size <= slot_size) {
+            op->slot = take_slot();
+        }
+        if (op->slot >= 0) {
+            op->target = slot_memory + op->slot * slot_size;
+        }
+        else {
+            op->heap.resize(op->size);
+            op->target = op->heap.data();
+        }
+        return true;
+    }
+
+    //Queues the remaining part of the transfer; short reads and writes simply come back here
+    void prepare(Operation* op) {
+        io_uring_sqe* sqe = next_sqe();
+        size_t remaining = op->size - op->done_bytes;
+        sqe->fd = op->fd;
+        sqe->off = op->done_bytes;
+        sqe->user_data = reinterpret_cast<__u64>(op);
+
+        if (op->slot >= 0) {
+            sqe->opcode = op->writing ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->addr = reinterpret_cast<__u64>(op->target + op->done_bytes);
+            sqe->len = remaining;
+            sqe->buf_index = op->slot;
+        }
+        else {
+            op->vec.iov_base = op->target + op->done_bytes;
+            op->vec.iov_len = remaining;
+            sqe->opcode = op->writing ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->addr = reinterpret_cast<__u64>(&op->vec);
+            sqe->len = 1;
+        }
+        in_flight++;
+    }
+
+    void finish(Operation* op, int error) {
+        if (op->fd >= 0 && close(op->fd) != 0 && error == 0 && op->writing) {
+            error = errno;
+        }
+
+        if (op->writing) {
+            tracked_free(op->write_data);
+            op->write_done(error);
+        }
+        else {
+            IoBuffer buffer;
+            buffer.slot = op->slot;
+            buffer.size = op->size;
+            buffer.heap = std::move(op->heap);
+            buffer.data = op->slot >= 0 ? op->target : buffer.heap.data();
+            if (error != 0 && op->slot >= 0) {
+                release(buffer);
+            }
+            op->read_done(error, std::move(buffer));
+        }
+        delete op;
+    }
+
+    void complete(Operation* op, int result) {
+        in_flight--;
+        if (result < 0) {
+            finish(op, -result);
+            return;
+        }
+        if (result == 0 && op->done_bytes < op->size) {
+            //File shrank underneath us
+            finish(op, EIO);
+            return;
+        }
+        op->done_bytes += result;
+        if (op->done_bytes < op->size) {
+            if (fallback != nullptr) {
+                hand_over(op);
+                return;
+            }
+            prepare(op);
+            return;
+        }
+        finish(op, 0);
+    }
+
+    //Gives an operation the ring will not carry out to the fallback, which does it again from the start
+    void hand_over(Operation* op) {
+        if (op->fd >= 0) {
+            close(op->fd);
+        }
+        if (op->slot >= 0) {
+            std::lock_guard<std::mutex> lock(slot_mutex);
+            free_slots.push_back(op->slot);
+        }
+        if (op->writing) {
+            fallback->write_file(op->path, op->write_data, op->size, std::move(op->write_done));
+        }
+        else {
+            fallback->read_file(op->path, std::move(op->read_done));
+        }
+        delete op;
+    }
+
+    //Handles every completion the kernel has posted
+    void reap() {
+        unsigned head = *cq_head;
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe* cqe = &cqes[head & cq_mask];
+            __u64 tag = cqe->user_data;
+            int result = cqe->res;
+            head++;
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+            if (tag == wake_tag) {
+                uint64_t count;
+                [[maybe_unused]] ssize_t drained = ::read(wake_fd, &count, sizeof(count));
+                if (fallback == nullptr) {
+                    arm_wake_poll();
+                }
+                continue;
+            }
+            complete(reinterpret_cast<Operation*>(tag), result);
+        }
+    }
+
+    //The ring can no longer submit: operations still waiting, in local, pending or in submission entries the kernel has
+    //not consumed, go to the fallback. Those the kernel took keep their buffers until their completions arrive, which
+    //they do without io_uring_enter().
+    void fail_over(int error, std::deque<Operation*>& local) {
+        log_error() << "Error: io_uring_enter: " << strerror(error) << ", falling back to blocking I/O threads";
+        std::vector<Operation*> stranded(local.begin(), local.end());
+        local.clear();
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        for (unsigned i = head; i != *sq_tail; i++) {
+            __u64 tag = sqes[sq_array[i & sq_mask]].user_data;
+            if (tag != wake_tag) {
+                stranded.push_back(reinterpret_cast<Operation*>(tag));
+                in_flight--;
+            }
+        }
+        __atomic_store_n(sq_tail, head, __ATOMIC_RELEASE);
+        queued = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fallback = std::make_unique<ThreadPoolBackend>(2);
+            stranded.insert(stranded.end(), pending.begin(), pending.end());
+            pending.clear();
+        }
+        for (Operation* op : stranded) {
+            hand_over(op);
+        }
+        while (in_flight > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            reap();
+        }
+    }
+
+    void run() {
+        arm_wake_poll();
+        std::deque<Operation*> local;
+
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping && pending.empty() && local.empty() && in_flight == 0) {
+                    break;
+                }
+                local.insert(local.end(), pending.begin(), pending.end());
+                pending.clear();
+            }
+
+            //Keep one entry of headroom for re-arming the wake poll
+            while (!local.empty() && in_flight + 2 < sq_entries) {
+                prepare(local.front());
+                local.pop_front();
+            }
+
+            int ret = uring_enter(ring_fd, queued, 1, IORING_ENTER_GETEVENTS);
+            if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                fail_over(errno, local);
+                return;
+            }
+            if (ret > 0) {
+                queued -= std::min<unsigned>(queued, ret);
+            }
+            reap();
+        }
+    }
+
+    int ring_fd = -1;
+    int wake_fd = -1;
+    unsigned char* sq_ring = nullptr;
+    unsigned char* cq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned queued = 0;
+    unsigned in_flight = 0;
+
+    unsigned char* slot_memory = nullptr;
+    size_t slot_total = 0;
+    size_t slot_size = 0;
+    std::vector<int> free_slots;
+    std::mutex slot_mutex;
+
+    std::thread io_thread;
+    std::mutex mutex;
+    std::deque<Operation*> pending;
+    bool stopping = false;
+    //Set by the I/O thread when the ring fails, read by the open pool under mutex
+    std::unique_ptr<ThreadPoolBackend> fallback;
+    ThreadPool open_pool{2};
+};
+
+//Picks io_uring when the kernel lets us, otherwise falls back to a pool of blocking I/O threads
+std::unique_ptr<IoBackend> make_io_backend(int queue_depth, size_t slot_size, bool allow_uring) {
+    if (allow_uring) {
+        unsigned entries = 8;
+        while (entries < static_cast<unsigned>(queue_depth) * 2 + 2) {
+            entries *= 2;
+        }
+        if (auto backend = UringBackend::create(entries, queue_depth, slot_size)) {
+            return backend;
+        }
+    }
+    return std::make_unique<ThreadPoolBackend>(std::max(2, queue_depth / 2));
+}
+
+#endif //SEAMCARVING_BATCH_IO_H
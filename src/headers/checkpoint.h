@@ -0,0 +1,86 @@
+#ifndef SEAMCARVING_CHECKPOINT_H
+#define SEAMCARVING_CHECKPOINT_H
+
+#include "main.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+//Where a long carve got to, enough to continue it without decoding the input again
+//input_hash, remove, seam_count and energy identify the carve; a checkpoint of a different one must not be resumed.
+struct CarveCheckpoint {
+    uint64_t input_hash = 0;
+    int remove = 0;
+    int seam_count = 0;
+    int removed = 0;
+    int width = 0;
+    int height = 0;
+    EnergyKind energy = EnergyKind::gradient;
+
+    bool resumes(uint64_t hash, int requested_remove, int requested_seam_count, EnergyKind requested_energy) const {
+        return input_hash == hash && remove == requested_remove && seam_count == requested_seam_count && energy == requested_energy;
+    }
+};
+
+//File layout: "SCK3", remove, seam_count, removed, width, height and energy kind as uint32, the input hash as uint64,
+//then the packed pixels, energy map and, for energies with diagonal costs, diagonal map, each compacted to width
+//pixels per row
+//Written to a temporary name first, so a preemption during the write leaves the previous checkpoint intact.
+bool save_checkpoint(const std::string& path, const CarveCheckpoint& state, const unsigned int* img, const CarveWorkspace& workspace, int raw_width) {
+    std::string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    uint32_t header[7] = {0x334B4353, static_cast<uint32_t>(state.remove), static_cast<uint32_t>(state.seam_count),
+                          static_cast<uint32_t>(state.removed), static_cast<uint32_t>(state.width), static_cast<uint32_t>(state.height),
+                          static_cast<uint32_t>(state.energy)};
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1 && fwrite(&state.input_hash, sizeof(uint64_t), 1, file) == 1;
+    for (int y = 0; ok && y < state.height; y++) {
+        ok = fwrite(img + compute_offset(0, y, raw_width, 1), sizeof(unsigned int), state.width, file) == static_cast<size_t>(state.width);
+    }
+    for (int y = 0; ok && y < state.height; y++) {
+        ok = fwrite(&workspace.energy[compute_offset(0, y, raw_width, 1)], sizeof(unsigned short), state.width, file) == static_cast<size_t>(state.width);
+    }
+    for (int y = 0; ok && !workspace.diagonal.empty() && y < state.height; y++) {
+        ok = fwrite(&workspace.diagonal[compute_offset(0, y, raw_width, 1)], sizeof(unsigned short), state.width, file) == static_cast<size_t>(state.width);
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+//Restores the buffers into the workspace, after which carve_prepared() continues with a raw_width of state.width
+//The workspace's energy_kind is left alone, resumes() tells whether it matches the checkpoint's.
+bool load_checkpoint(const std::string& path, CarveCheckpoint& state, CarveWorkspace& workspace) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    uint32_t header[7];
+    bool ok = fread(header, sizeof(header), 1, file) == 1 && header[0] == 0x334B4353 && header[4] > 0 && header[5] > 0
+        && header[6] < static_cast<uint32_t>(energy_kind_count)
+        && fread(&state.input_hash, sizeof(uint64_t), 1, file) == 1;
+    if (ok) {
+        state.remove = static_cast<int>(header[1]);
+        state.seam_count = static_cast<int>(header[2]);
+        state.removed = static_cast<int>(header[3]);
+        state.width = static_cast<int>(header[4]);
+        state.height = static_cast<int>(header[5]);
+        state.energy = static_cast<EnergyKind>(header[6]);
+        size_t pixels = static_cast<size_t>(state.width) * state.height;
+        workspace.pixels.resize(pixels);
+        workspace.energy.resize(pixels);
+        workspace.diagonal.resize(energy_functions(state.energy).diagonal_costs ? pixels : 0);
+        ok = fread(workspace.pixels.data(), sizeof(unsigned int), pixels, file) == pixels
+            && fread(workspace.energy.data(), sizeof(unsigned short), pixels, file) == pixels
+            && fread(workspace.diagonal.data(), sizeof(unsigned short), workspace.diagonal.size(), file) == workspace.diagonal.size();
+    }
+    fclose(file);
+    return ok;
+}
+
+#endif //SEAMCARVING_CHECKPOINT_H
@@ -0,0 +1,201 @@
+#ifndef SEAMCARVING_COALESCING_H
+#define SEAMCARVING_COALESCING_H
+
+#include "main.h"
+#include "image_cache.h"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+
+//Request waiting on a coalesced job for the image with remove pixels taken off
+//Once ready, pixels holds the compacted result (allocated with tracked_malloc, so it goes back through tracked_free) or
+//error says what went wrong
+struct CoalescedWaiter {
+    int remove = 0;
+    bool ready = false;
+    std::string error;
+    unsigned int* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+};
+
+//One run of the removal loop serving every request for the same source
+//pending only holds waiters whose width has not been passed yet; all members but cancel are guarded by mutex
+struct CoalescedJob {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::vector<CoalescedWaiter*> pending;
+    //Triggered once every waiter gave up, and reset when another one attaches
+    CancellationToken cancel;
+    bool started = false;
+    bool finished = false;
+    int width = 0;
+    int removed = 0;
+};
+
+//Identical sources only share a job if they also build the same seams
+struct CoalescingKey {
+    uint64_t content;
+    int seam_count;
+
+    bool operator<(const CoalescingKey& other) const {
+        return content != other.content ? content < other.content : seam_count < other.seam_count;
+    }
+};
+
+//Jobs currently running, by source
+//Lock order is the registry before any job.
+class CoalescingRegistry {
+public:
+    //Attaches waiter to the running job for key if that has not carved past its width yet
+    //Otherwise starts a new job led by the caller, provided may_start() agrees; returns nullptr if it does not
+    std::shared_ptr<CoalescedJob> attach(const CoalescingKey& key, CoalescedWaiter* waiter, bool& leader, const std::function<bool()>& may_start) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = jobs.find(key);
+        if (it != jobs.end()) {
+            std::shared_ptr<CoalescedJob> job = it->second;
+            std::lock_guard<std::mutex> job_lock(job->mutex);
+            if (!job->finished) {
+                int remove = job->started ? std::min(waiter->remove, job->width - 1) : waiter->remove;
+                if (!job->started || remove > job->removed) {
+                    waiter->remove = remove;
+                    job->pending.push_back(waiter);
+                    job->cancel.reset();
+                    coalesced++;
+                    leader = false;
+                    return job;
+                }
+            }
+        }
+
+        if (!may_start()) {
+            return nullptr;
+        }
+        auto job = std::make_shared<CoalescedJob>();
+        job->pending.push_back(waiter);
+        jobs[key] = job;
+        leader = true;
+        return job;
+    }
+
+    //Retires job once nobody is waiting on it anymore, failing whoever still is if error is given
+    //Returns false if waiters attached in the meantime and the job has to carry on
+    bool finish(const CoalescingKey& key, const std::shared_ptr<CoalescedJob>& job, const std::string& error = "") {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::lock_guard<std::mutex> job_lock(job->mutex);
+        if (error.empty() && !job->pending.empty()) {
+            return false;
+        }
+        for (CoalescedWaiter* waiter : job->pending) {
+            waiter->error = error;
+            waiter->ready = true;
+        }
+        job->pending.clear();
+        job->finished = true;
+        job->ready.notify_all();
+
+        auto it = jobs.find(key);
+        if (it != jobs.end() && it->second == job) {
+            jobs.erase(it);
+        }
+        return true;
+    }
+
+    //Waits for the waiter's result, polling abandoned() in between
+    //If that reports the requester gone first, the waiter is detached and the job cancelled if it was the last one;
+    //returns false then, though pixels may still have arrived in the meantime and need tracked_free.
+    static bool wait(CoalescedJob& job, CoalescedWaiter& waiter, const std::function<bool()>& abandoned) {
+        std::unique_lock<std::mutex> lock(job.mutex);
+        while (!job.ready.wait_for(lock, std::chrono::milliseconds(100), [&] { return waiter.ready; })) {
+            if (abandoned()) {
+                job.pending.erase(std::remove(job.pending.begin(), job.pending.end(), &waiter), job.pending.end());
+                if (job.pending.empty()) {
+                    job.cancel.cancel();
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    unsigned long coalesced_requests() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return coalesced;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<CoalescingKey, std::shared_ptr<CoalescedJob>> jobs;
+    unsigned long coalesced = 0;
+};
+
+//Decodes input once and runs the removal loop as far as the narrowest waiter needs, which may grow as others attach
+//Every waiter gets a compacted copy of the image the moment the loop reaches its width.
+void run_coalesced_job(CoalescingRegistry& registry, const CoalescingKey& key, const std::shared_ptr<CoalescedJob>& job,
+                       const std::vector<unsigned char>& input, ImageCache* cache, CarveWorkspace& workspace) {
+    int width, height;
+    std::string error = load_prepared(input.data(), input.size(), key.content, cache, workspace, width, height);
+    if (!error.empty()) {
+        registry.finish(key, job, error);
+        return;
+    }
+    unsigned int* img = workspace.pixels.data();
+    int raw_width = width;
+
+    //Expects job->mutex to be held
+    auto serve_reached = [&] {
+        for (auto it = job->pending.begin(); it != job->pending.end();) {
+            CoalescedWaiter* waiter = *it;
+            if (waiter->remove != job->removed) {
+                ++it;
+                continue;
+            }
+            waiter->pixels = compacted_copy(img, width, height, raw_width);
+            waiter->width = width;
+            waiter->height = height;
+            waiter->ready = true;
+            it = job->pending.erase(it);
+        }
+        job->ready.notify_all();
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->started = true;
+        job->width = width;
+        for (CoalescedWaiter* waiter : job->pending) {
+            waiter->remove = std::min(waiter->remove, width - 1);
+        }
+        serve_reached();
+    }
+
+    while (true) {
+        int goal = 0;
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            for (CoalescedWaiter* waiter : job->pending) {
+                goal = std::max(goal, waiter->remove);
+            }
+            goal -= job->removed;
+        }
+        if (goal <= 0) {
+            if (registry.finish(key, job)) {
+                return;
+            }
+            continue;
+        }
+
+        CarveOptions options;
+        options.cancel = &job->cancel;
+        options.on_removed = [&](const std::vector<int>&) {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->removed++;
+            serve_reached();
+        };
+        carve_prepared(img, width, height, raw_width, goal, key.seam_count, workspace, options);
+    }
+}
+
+#endif //SEAMCARVING_COALESCING_H
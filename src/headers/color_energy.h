@@ -0,0 +1,124 @@
+#ifndef SEAMCARVING_COLOR_ENERGY_H
+#define SEAMCARVING_COLOR_ENERGY_H
+
+#include "luma.h"
+
+//Dual gradient energy on the colour channels: squared differences of R, G and B between the left and right neighbour
+//plus those between the upper and lower one. Unlike a gradient on luma it sees edges between colours of equal brightness.
+//The sum is at most 6 * 255^2 and shifted down to at most 24384, so it stays a 16 bit energy below the border's
+//UINT16_MAX and survives the signed 16 bit pack of the vector kernels. Alpha is ignored.
+const int color_energy_shift = 4;
+
+unsigned int squared_color_difference(unsigned int a, unsigned int b) {
+    int red = static_cast<int>(a & 0xFF) - static_cast<int>(b & 0xFF);
+    int green = static_cast<int>((a >> 8) & 0xFF) - static_cast<int>((b >> 8) & 0xFF);
+    int blue = static_cast<int>((a >> 16) & 0xFF) - static_cast<int>((b >> 16) & 0xFF);
+    return red * red + green * green + blue * blue;
+}
+
+unsigned short color_gradient(unsigned int left, unsigned int right, unsigned int upper, unsigned int lower) {
+    return static_cast<unsigned short>((squared_color_difference(left, right) + squared_color_difference(upper, lower)) >> color_energy_shift);
+}
+
+//Energy of count pixels in a row, where current, upper and lower point at the first pixel's row and the rows around it
+//current[-1] and current[count] are read as the neighbours of the first and the last pixel.
+void color_energy_row_scalar(unsigned short* out, const unsigned int* upper, const unsigned int* current, const unsigned int* lower, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = color_gradient(current[i-1], current[i+1], upper[i], lower[i]);
+    }
+}
+
+#ifdef SEAMCARVING_X86
+
+//Squared colour differences of four pixel pairs as 32 bit lanes
+//The channel differences are widened to 16 bit, so one madd of them with themselves gives R^2 + G^2 and B^2 per pixel.
+__m128i color_squares_sse2(__m128i a, __m128i b) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i colors = _mm_set1_epi32(0x00FFFFFF);
+    a = _mm_and_si128(a, colors);
+    b = _mm_and_si128(b, colors);
+    __m128i low = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    __m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+    low = _mm_madd_epi16(low, low);
+    high = _mm_madd_epi16(high, high);
+    low = _mm_add_epi32(low, _mm_srli_epi64(low, 32));
+    high = _mm_add_epi32(high, _mm_srli_epi64(high, 32));
+    return _mm_unpacklo_epi64(_mm_shuffle_epi32(low, _MM_SHUFFLE(3, 3, 2, 0)), _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 3, 2, 0)));
+}
+
+__m128i color_gradients_sse2(const unsigned int* upper, const unsigned int* current, const unsigned int* lower) {
+    __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current - 1));
+    __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + 1));
+    __m128i up = _mm_loadu_si128(reinterpret_cast<const __m128i*>(upper));
+    __m128i down = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lower));
+    __m128i sum = _mm_add_epi32(color_squares_sse2(left, right), color_squares_sse2(up, down));
+    return _mm_srli_epi32(sum, color_energy_shift);
+}
+
+//8 pixels per iteration
+void color_energy_row_sse2(unsigned short* out, const unsigned int* upper, const unsigned int* current, const unsigned int* lower, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = color_gradients_sse2(upper + i, current + i, lower + i);
+        __m128i b = color_gradients_sse2(upper + i + 4, current + i + 4, lower + i + 4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(a, b));
+    }
+    color_energy_row_scalar(out + i, upper + i, current + i, lower + i, count - i);
+}
+
+//Same as color_squares_sse2() on each 128 bit lane
+__attribute__((target("avx2"))) __m256i color_squares_avx2(__m256i a, __m256i b) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i colors = _mm256_set1_epi32(0x00FFFFFF);
+    a = _mm256_and_si256(a, colors);
+    b = _mm256_and_si256(b, colors);
+    __m256i low = _mm256_sub_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+    __m256i high = _mm256_sub_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+    low = _mm256_madd_epi16(low, low);
+    high = _mm256_madd_epi16(high, high);
+    low = _mm256_add_epi32(low, _mm256_srli_epi64(low, 32));
+    high = _mm256_add_epi32(high, _mm256_srli_epi64(high, 32));
+    return _mm256_unpacklo_epi64(_mm256_shuffle_epi32(low, _MM_SHUFFLE(3, 3, 2, 0)), _mm256_shuffle_epi32(high, _MM_SHUFFLE(3, 3, 2, 0)));
+}
+
+__attribute__((target("avx2"))) __m256i color_gradients_avx2(const unsigned int* upper, const unsigned int* current, const unsigned int* lower) {
+    __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current - 1));
+    __m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current + 1));
+    __m256i up = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(upper));
+    __m256i down = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lower));
+    __m256i sum = _mm256_add_epi32(color_squares_avx2(left, right), color_squares_avx2(up, down));
+    return _mm256_srli_epi32(sum, color_energy_shift);
+}
+
+//16 pixels per iteration
+//The pack interleaves the two inputs per 128 bit lane, one permute of 64 bit quarters puts the pixels back in order.
+__attribute__((target("avx2"))) void color_energy_row_avx2(unsigned short* out, const unsigned int* upper, const unsigned int* current, const unsigned int* lower, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i a = color_gradients_avx2(upper + i, current + i, lower + i);
+        __m256i b = color_gradients_avx2(upper + i + 8, current + i + 8, lower + i + 8);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+    color_energy_row_sse2(out + i, upper + i, current + i, lower + i, count - i);
+}
+
+#endif //SEAMCARVING_X86
+
+using ColorEnergyRow = void (*)(unsigned short* out, const unsigned int* upper, const unsigned int* current, const unsigned int* lower, int count);
+
+//The widest kernel this CPU runs, picked once
+ColorEnergyRow color_energy_row_kernel() {
+#ifdef SEAMCARVING_X86
+    static const ColorEnergyRow kernel = __builtin_cpu_supports("avx2") ? color_energy_row_avx2 : color_energy_row_sse2;
+    return kernel;
+#else
+    return color_energy_row_scalar;
+#endif
+}
+
+void color_energy_row(unsigned short* out, const unsigned int* upper, const unsigned int* current, const unsigned int* lower, int count) {
+    color_energy_row_kernel()(out, upper, current, lower, count);
+}
+
+#endif //SEAMCARVING_COLOR_ENERGY_H
@@ -0,0 +1,654 @@
+#ifndef SEAMCARVING_DAEMON_H
+#define SEAMCARVING_DAEMON_H
+
+#include "main.h"
+#include "coalescing.h"
+#include "deadline.h"
+#include "image_cache.h"
+#include "scheduler.h"
+#include "shm_frames.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <csignal>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <map>
+#include <string>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//Protocol spoken on the daemon socket
+//
+//Every request is a single line of space separated key=value fields, optionally followed by a binary payload:
+//  op=ping
+//  op=stats
+//  op=carve remove=<pixels> [seams=<count>] in=<input path> [out=<output path>]
+//  op=carve remove=<pixels> [seams=<count>] bytes=<length> [out=<output path>]   followed by <length> bytes of .png/.jpg
+//  op=carve_shm remove=<pixels> [seams=<count>] width=<w> height=<h> (in_shm=<name> | in_fd=<i>) [in_offset=<bytes>]
+//               [(out_shm=<name> | out_fd=<i>) [out_offset=<bytes>]]
+//
+//carve_shm works on raw RGBA frames in shared memory without copying them through the socket (see shm_frames.h).
+//Frames are POSIX shm objects or descriptors (e.g. memfds) passed via SCM_RIGHTS; <i> indexes the descriptors
+//received since the previous request, which are closed once the request is done.
+//
+//Every reply is a single line as well:
+//  status=ok width=<w> height=<h> out=<output path>
+//  status=ok width=<w> height=<h> bytes=<length>   followed by <length> bytes of .png
+//  status=ok width=<w> height=<h>                  for carve_shm, rows are packed with a stride of <w> pixels
+//  status=error message=<text>
+//
+//Carve requests for the same input bytes and seams that are in flight at the same time share one run of the removal
+//loop, which goes as far as the narrowest of them and answers each as soon as it passes their width.
+//
+//Decoded images and their energy maps are cached by the hash of the input bytes, so repeated requests for the same
+//source start at the seam search. op=stats replies with the cache counters (status=ok cache_hits=<n> ...).
+//
+//op=carve may carry deadline_ms=<ms>, counted from when the request was received. Such a carve runs on its own and
+//falls back to removing several seams per search or to resampling when it would not finish in time otherwise
+//(see deadline.h); its reply adds strategy=<exact|batch|resample>.
+//
+//Every carve may carry priority=<n> (default 0). Admitted carves start by descending priority, then shortest
+//predicted job first, as long as their predicted peak memory fits into the budget; larger ones are rejected.
+//
+//A client that disconnects while its carve is running cancels it; coalesced carves stop once nobody waits on them.
+//
+//Values cannot contain spaces. A connection may send any number of requests one after another.
+//
+//in= and out= are opened with the daemon's privileges, so any client able to connect can read and write whatever the
+//daemon can. With --root they must resolve, symlinks included, to a place within that directory, and relative paths
+//are taken from there. The check is made before the file is opened, so clients that can create symlinks within the
+//root are still able to redirect a request elsewhere.
+
+struct DaemonOptions {
+    std::string socket_path;
+    int threads = 1;
+    //Carves queued or running at once, further requests are answered with message=busy
+    int max_inflight = 16;
+    int max_connections = 64;
+    size_t max_request_bytes = 256 << 20;
+    //Workspaces larger than this are released after a carve instead of being kept for the next one
+    size_t workspace_keep_bytes = 512 << 20;
+    //Upper bound for the summed predicted peak memory of the carves running at once
+    size_t memory_budget = default_memory_budget();
+    //0 disables the cache of decoded images, cache_dir additionally keeps them on disk
+    size_t cache_bytes = 256 << 20;
+    std::string cache_dir;
+    //Canonical directory in= and out= paths must lie within, empty for no restriction
+    std::string root;
+};
+
+using RequestFields = std::map<std::string, std::string>;
+
+bool parse_request_fields(const std::string& line, RequestFields& fields) {
+    size_t start = 0;
+    while (start < line.size()) {
+        size_t end = line.find(' ', start);
+        if (end == std::string::npos) {
+            end = line.size();
+        }
+        if (end > start) {
+            size_t equals = line.find('=', start);
+            if (equals == std::string::npos || equals >= end) {
+                return false;
+            }
+            fields[line.substr(start, equals - start)] = line.substr(equals + 1, end - equals - 1);
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+std::string error_reply(std::string message) {
+    std::replace(message.begin(), message.end(), ' ', '_');
+    return "status=error message=" + message + "\n";
+}
+
+//Result of one request; data (if any) was allocated by stb_image_write and is sent after the header
+struct DaemonReply {
+    std::string header;
+    unsigned char* data = nullptr;
+    int size = 0;
+};
+
+int field_to_int(const RequestFields& fields, const std::string& key, int fallback) {
+    auto it = fields.find(key);
+    if (it == fields.end()) {
+        return fallback;
+    }
+    return std::stoi(it->second);
+}
+
+//Resolves a path a client sent against root, following symlinks as far as the path exists; false if the result lies
+//outside root. Without a root every path is taken as it is.
+bool resolve_client_path(const std::string& root, std::string& path) {
+    if (root.empty()) {
+        return true;
+    }
+    std::error_code error;
+    std::filesystem::path resolved = std::filesystem::weakly_canonical(std::filesystem::path(root) / path, error);
+    if (error) {
+        return false;
+    }
+    std::filesystem::path base(root);
+    if (std::mismatch(base.begin(), base.end(), resolved.begin(), resolved.end()).first != base.end()) {
+        return false;
+    }
+    path = resolved.string();
+    return true;
+}
+
+//Encodes a carved image as the request asks for, either into the out file or into the reply
+DaemonReply encode_reply(const unsigned int* img, int width, int height, const RequestFields& fields) {
+    DaemonReply reply;
+    unsigned char* raw_img = convert_to_char(img, width, height, 4);
+
+    std::string dimensions = "status=ok width=" + std::to_string(width) + " height=" + std::to_string(height);
+    auto out = fields.find("out");
+    if (out != fields.end()) {
+        if (stbi_write_png(out->second.c_str(), width, height, 4, raw_img, width * 4)) {
+            reply.header = dimensions + " out=" + out->second + "\n";
+        }
+        else {
+            reply.header = error_reply("cannot write output");
+        }
+    }
+    else {
+        reply.data = stbi_write_png_to_mem(raw_img, width * 4, width, height, 4, &reply.size);
+        if (reply.data != nullptr) {
+            reply.header = dimensions + " bytes=" + std::to_string(reply.size) + "\n";
+        }
+        else {
+            reply.header = error_reply("encoding failed");
+        }
+    }
+    tracked_free(raw_img);
+    return reply;
+}
+
+//Long-running carve server on a Unix domain socket
+//Connections are served by their own threads, carves run on a warm pool whose threads keep their workspaces.
+//SIGTERM/SIGINT stop the listener, let every request already received finish and then return.
+class CarveDaemon {
+public:
+    explicit CarveDaemon(const DaemonOptions& options)
+        : options(options), pool(options.threads), scheduler(options.memory_budget, options.threads) {
+        if (options.cache_bytes > 0) {
+            cache = std::make_unique<ImageCache>(options.cache_bytes, options.cache_dir);
+        }
+    }
+
+    //Expects SIGTERM and SIGINT to be blocked in every thread, see run_daemon()
+    int run() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGINT);
+        int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+        int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (options.socket_path.size() >= sizeof(address.sun_path)) {
+            log_error() << "Error: socket path too long";
+            return 1;
+        }
+        strcpy(address.sun_path, options.socket_path.c_str());
+        unlink(options.socket_path.c_str());
+        if (listen_fd < 0 || signal_fd < 0 || bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_fd, 128) != 0) {
+            log_error() << "Error: cannot listen on socket: " << strerror(errno);
+            return 1;
+        }
+        log_info() << "Listening on " << options.socket_path << " with " << options.threads << " carve threads";
+
+        pollfd fds[2] = {{listen_fd, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+        while (true) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (fds[1].revents & POLLIN) {
+                break;
+            }
+            if (fds[0].revents & POLLIN) {
+                int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client >= 0) {
+                    start_connection(client);
+                }
+            }
+            reap_connections(false);
+        }
+
+        log_info() << "Draining " << active_jobs.load() << " in-flight requests";
+        close(listen_fd);
+        unlink(options.socket_path.c_str());
+        draining = true;
+        reap_connections(true);
+        pool.wait_idle();
+        close(signal_fd);
+        log_info() << "Daemon stopped";
+        return 0;
+    }
+
+private:
+    struct Connection {
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    void start_connection(int fd) {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        if (static_cast<int>(connections.size()) >= options.max_connections) {
+            send_all(fd, error_reply("busy"));
+            close(fd);
+            return;
+        }
+        connections.emplace_back();
+        Connection& connection = connections.back();
+        connection.thread = std::thread([this, fd, &connection] {
+            serve(fd);
+            close(fd);
+            connection.done = true;
+        });
+    }
+
+    void reap_connections(bool all) {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        for (auto it = connections.begin(); it != connections.end();) {
+            if (all || it->done) {
+                it->thread.join();
+                it = connections.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    static bool send_all(int fd, const void* data, size_t size) {
+        auto* bytes = static_cast<const unsigned char*>(data);
+        while (size > 0) {
+            ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                return false;
+            }
+            bytes += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    static bool send_all(int fd, const std::string& text) {
+        return send_all(fd, text.data(), text.size());
+    }
+
+    //Fills buffer with more bytes from fd and collects descriptors passed along with them
+    //Gives up on an idle connection once the daemon drains
+    bool receive(int fd, std::string& buffer, std::vector<int>& fds) {
+        char chunk[64 << 10];
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * 8)];
+        while (true) {
+            pollfd readable{fd, POLLIN, 0};
+            int ready = poll(&readable, 1, 200);
+            if (ready == 0) {
+                if (draining && buffer.empty()) {
+                    return false;
+                }
+                continue;
+            }
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            iovec vec{chunk, sizeof(chunk)};
+            msghdr message{};
+            message.msg_iov = &vec;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            ssize_t received = ready > 0 ? recvmsg(fd, &message, MSG_CMSG_CLOEXEC) : -1;
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+                if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+                    size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                    for (size_t i = 0; i < count; i++) {
+                        int passed;
+                        memcpy(&passed, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                        fds.push_back(passed);
+                    }
+                }
+            }
+            if (received <= 0) {
+                return false;
+            }
+            buffer.append(chunk, received);
+            return true;
+        }
+    }
+
+    static void close_all(std::vector<int>& fds) {
+        for (int passed : fds) {
+            close(passed);
+        }
+        fds.clear();
+    }
+
+    void serve(int fd) {
+        std::string buffer;
+        std::vector<unsigned char> payload;
+        std::vector<int> fds;
+        serve(fd, buffer, payload, fds);
+        close_all(fds);
+    }
+
+    void serve(int fd, std::string& buffer, std::vector<unsigned char>& payload, std::vector<int>& fds) {
+        while (true) {
+            size_t newline;
+            while ((newline = buffer.find('\n')) == std::string::npos) {
+                if (buffer.size() > 4096 || !receive(fd, buffer, fds)) {
+                    return;
+                }
+            }
+            std::string line = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+
+            RequestFields fields;
+            if (!parse_request_fields(line, fields)) {
+                send_all(fd, error_reply("malformed request"));
+                return;
+            }
+
+            payload.clear();
+            if (fields.count("bytes")) {
+                size_t length;
+                try {
+                    length = std::stoul(fields["bytes"]);
+                } catch (std::exception& exception) {
+                    send_all(fd, error_reply("invalid number"));
+                    return;
+                }
+                if (length > options.max_request_bytes) {
+                    send_all(fd, error_reply("request too large"));
+                    return;
+                }
+                while (buffer.size() < length) {
+                    if (!receive(fd, buffer, fds)) {
+                        return;
+                    }
+                }
+                payload.assign(buffer.begin(), buffer.begin() + length);
+                buffer.erase(0, length);
+            }
+
+            DaemonReply reply = handle(fields, payload, fds, fd);
+            close_all(fds);
+            bool sent = send_all(fd, reply.header) && (reply.data == nullptr || send_all(fd, reply.data, reply.size));
+            tracked_free(reply.data);
+            if (!sent) {
+                return;
+            }
+        }
+    }
+
+    //Whether the client closed its end while its request was being carved
+    static bool peer_gone(int fd) {
+        pollfd closed{fd, POLLRDHUP, 0};
+        return poll(&closed, 1, 0) > 0 && (closed.revents & (POLLRDHUP | POLLHUP | POLLERR));
+    }
+
+    DaemonReply handle(RequestFields fields, const std::vector<unsigned char>& payload, const std::vector<int>& fds, int client) {
+        auto received = DeadlineClock::now();
+        DaemonReply reply;
+        auto op = fields.find("op");
+        if (op == fields.end()) {
+            reply.header = error_reply("missing op");
+            return reply;
+        }
+        if (op->second == "ping") {
+            reply.header = "status=ok\n";
+            return reply;
+        }
+        if (op->second == "stats") {
+            reply.header = "status=ok coalesced=" + std::to_string(coalescing.coalesced_requests()) + " "
+                + (cache != nullptr ? cache->stats() : std::string("cache=off")) + "\n";
+            return reply;
+        }
+        bool shared = op->second == "carve_shm";
+        if (op->second != "carve" && !shared) {
+            reply.header = error_reply("unknown op");
+            return reply;
+        }
+        if (!shared && !fields.count("in") && !fields.count("bytes")) {
+            reply.header = error_reply("carve needs in or bytes");
+            return reply;
+        }
+        for (const char* key : {"in", "out"}) {
+            auto path = fields.find(key);
+            if (path != fields.end() && !resolve_client_path(options.root, path->second)) {
+                reply.header = error_reply(std::string(key) + " is outside the root");
+                return reply;
+            }
+        }
+
+        std::vector<unsigned char> file_bytes;
+        if (fields.count("in") && !read_whole_file(fields.at("in"), file_bytes)) {
+            reply.header = error_reply("cannot read " + fields.at("in"));
+            return reply;
+        }
+        const std::vector<unsigned char>& input = fields.count("in") ? file_bytes : payload;
+
+        JobCost cost;
+        int priority, remove, seam_count, deadline_ms;
+        try {
+            cost = predict_cost(fields, input, shared);
+            priority = field_to_int(fields, "priority", 0);
+            remove = field_to_int(fields, "remove", -1);
+            seam_count = field_to_int(fields, "seams", 100);
+            deadline_ms = field_to_int(fields, "deadline_ms", 0);
+        } catch (std::exception& exception) {
+            reply.header = error_reply("invalid number");
+            return reply;
+        }
+        if (remove < 0 || seam_count < 1) {
+            reply.header = error_reply("remove and seams must be positive");
+            return reply;
+        }
+        if (!scheduler.fits_budget(cost)) {
+            reply.header = error_reply("needs " + std::to_string(cost.peak_bytes >> 20) + " MiB, over the memory budget");
+            return reply;
+        }
+        if (!shared && deadline_ms > 0) {
+            auto deadline = received + std::chrono::milliseconds(deadline_ms);
+            return run_on_pool(client, cost, priority, [&](CarveWorkspace& workspace, const CancellationToken& cancel) {
+                return carve_before_deadline(fields, input, remove, seam_count, deadline, workspace, cancel);
+            });
+        }
+        if (!shared) {
+            return handle_coalesced(client, fields, input, cost, priority, remove, seam_count);
+        }
+
+        return run_on_pool(client, cost, priority, [&](CarveWorkspace& workspace, const CancellationToken& cancel) {
+            DaemonReply shared_reply;
+            int width, height;
+            std::string error = carve_shared_frame(fields, fds, workspace, width, height, &cancel);
+            shared_reply.header = error.empty()
+                ? "status=ok width=" + std::to_string(width) + " height=" + std::to_string(height) + "\n"
+                : error_reply(error);
+            return shared_reply;
+        });
+    }
+
+    //Runs carve on the pool once the scheduler admits it and waits for its reply
+    //The carve is cancelled if the client disconnects meanwhile, and its thread's workspace released right away.
+    DaemonReply run_on_pool(int client, const JobCost& cost, int priority,
+                            const std::function<DaemonReply(CarveWorkspace&, const CancellationToken&)>& carve) {
+        if (active_jobs.fetch_add(1) >= options.max_inflight) {
+            active_jobs--;
+            DaemonReply reply;
+            reply.header = error_reply("busy");
+            return reply;
+        }
+
+        //Waits here, on the connection's thread, so the pool only ever sees jobs that were let through in order
+        scheduler.acquire(cost, priority);
+
+        std::promise<DaemonReply> result;
+        std::future<DaemonReply> future = result.get_future();
+        CancellationToken cancel;
+        size_t keep_bytes = options.workspace_keep_bytes;
+        pool.submit([&carve, &result, &cancel, keep_bytes] {
+            thread_local CarveWorkspace workspace;
+            DaemonReply carved = carve(workspace, cancel);
+            workspace.trim(cancel.is_cancelled() ? 0 : keep_bytes);
+            result.set_value(std::move(carved));
+        });
+        while (future.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+            if (!cancel.is_cancelled() && peer_gone(client)) {
+                cancel.cancel();
+            }
+        }
+        DaemonReply reply = future.get();
+        scheduler.release(cost);
+        active_jobs--;
+        return reply;
+    }
+
+    //Never joins a coalesced job, a removal loop shared by several requests could not honour every deadline
+    DaemonReply carve_before_deadline(const RequestFields& fields, const std::vector<unsigned char>& input, int remove, int seam_count,
+                                      DeadlineClock::time_point deadline, CarveWorkspace& workspace, const CancellationToken& cancel) {
+        int width, height;
+        std::string error = load_prepared(input.data(), input.size(), hash_bytes(input.data(), input.size()), cache.get(), workspace, width, height);
+        if (!error.empty()) {
+            DaemonReply reply;
+            reply.header = error_reply(error);
+            return reply;
+        }
+
+        unsigned int* img = workspace.pixels.data();
+        int raw_width = width;
+        int n = std::min(remove, width - 1);
+        DeadlineReport report;
+        CarveOptions carve_options;
+        carve_options.cancel = &cancel;
+        if (!carve_with_deadline(img, width, height, raw_width, n, seam_count, workspace, deadline - predicted_encode_time(width - n, height), report, carve_options)) {
+            DaemonReply reply;
+            reply.header = error_reply("cancelled");
+            return reply;
+        }
+        compact_rows(img, width, height, raw_width);
+
+        DaemonReply reply = encode_reply(img, width, height, fields);
+        if (reply.header.starts_with("status=ok")) {
+            reply.header.insert(reply.header.size() - 1, std::string(" strategy=") + strategy_name(report.strategy));
+        }
+        return reply;
+    }
+
+    //Joins an identical request in flight, or else leads a new job on the pool that later ones may join
+    DaemonReply handle_coalesced(int client, const RequestFields& fields, const std::vector<unsigned char>& input, const JobCost& cost,
+                                 int priority, int remove, int seam_count) {
+        CoalescingKey key{hash_bytes(input.data(), input.size()), seam_count};
+        CoalescedWaiter waiter;
+        waiter.remove = remove;
+
+        bool leader;
+        std::shared_ptr<CoalescedJob> job = coalescing.attach(key, &waiter, leader, [this] {
+            if (active_jobs.fetch_add(1) >= options.max_inflight) {
+                active_jobs--;
+                return false;
+            }
+            return true;
+        });
+        if (job == nullptr) {
+            DaemonReply reply;
+            reply.header = error_reply("busy");
+            return reply;
+        }
+
+        if (leader) {
+            //Waits here, on the connection's thread, so the pool only ever sees jobs that were let through in order
+            scheduler.acquire(cost, priority);
+            auto owned_input = std::make_shared<std::vector<unsigned char>>(input);
+            size_t keep_bytes = options.workspace_keep_bytes;
+            pool.submit([this, key, job, owned_input, cost, keep_bytes] {
+                thread_local CarveWorkspace workspace;
+                run_coalesced_job(coalescing, key, job, *owned_input, cache.get(), workspace);
+                workspace.trim(job->cancel.is_cancelled() ? 0 : keep_bytes);
+                scheduler.release(cost);
+                active_jobs--;
+            });
+        }
+
+        if (!CoalescingRegistry::wait(*job, waiter, [client] { return peer_gone(client); })) {
+            tracked_free(waiter.pixels);
+            DaemonReply reply;
+            reply.header = error_reply("cancelled");
+            return reply;
+        }
+        if (!waiter.error.empty()) {
+            DaemonReply reply;
+            reply.header = error_reply(waiter.error);
+            return reply;
+        }
+        DaemonReply reply = encode_reply(waiter.pixels, waiter.width, waiter.height, fields);
+        tracked_free(waiter.pixels);
+        return reply;
+    }
+
+    //Reads only the image header; inputs whose header cannot be read cost nothing and fail in the decoder
+    static JobCost predict_cost(const RequestFields& fields, const std::vector<unsigned char>& input, bool shared) {
+        int width = 0, height = 0, channels;
+        size_t input_bytes = 0;
+        if (shared) {
+            width = field_to_int(fields, "width", 0);
+            height = field_to_int(fields, "height", 0);
+        }
+        else {
+            if (!stbi_info_from_memory(input.data(), static_cast<int>(input.size()), &width, &height, &channels)) {
+                return {};
+            }
+            input_bytes = input.size();
+        }
+        JobCost cost = estimate_job_cost(width, height, field_to_int(fields, "remove", 0), field_to_int(fields, "seams", 100),
+                                         default_energy_kind, input_bytes);
+        if (shared) {
+            //The frame itself lives in the client's segment and is never decoded or encoded here
+            cost.peak_bytes -= static_cast<size_t>(width) * height * (4 + 12);
+        }
+        return cost;
+    }
+
+    DaemonOptions options;
+    ThreadPool pool;
+    JobScheduler scheduler;
+    std::unique_ptr<ImageCache> cache;
+    CoalescingRegistry coalescing;
+    std::atomic<int> active_jobs{0};
+    std::atomic<bool> draining{false};
+    std::list<Connection> connections;
+    std::mutex connections_mutex;
+};
+
+int run_daemon(const DaemonOptions& options) {
+    //Signals are consumed through a signalfd, so they must be blocked before any thread is started
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    CarveDaemon daemon(options);
+    return daemon.run();
+}
+
+#endif //SEAMCARVING_DAEMON_H
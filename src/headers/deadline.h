@@ -0,0 +1,232 @@
+#ifndef SEAMCARVING_DEADLINE_H
+#define SEAMCARVING_DEADLINE_H
+
+#include "main.h"
+#include <chrono>
+#include <climits>
+
+using DeadlineClock = std::chrono::steady_clock;
+
+//How a deadline carve got rid of its pixels, from the best to the cheapest
+//exact removes one seam per seam search like carve_prepared(), batch removes several non-crossing seams per search,
+//resample scales the rows down to the target width without looking at the content
+enum class CarveStrategy {
+    exact,
+    batch,
+    resample
+};
+
+const char* strategy_name(CarveStrategy strategy) {
+    switch (strategy) {
+        case CarveStrategy::exact: return "exact";
+        case CarveStrategy::batch: return "batch";
+        case CarveStrategy::resample: return "resample";
+    }
+    return "unknown";
+}
+
+//strategy is the cheapest one the carve had to fall back to
+struct DeadlineReport {
+    CarveStrategy strategy = CarveStrategy::exact;
+    int exact_seams = 0;
+    int batch_seams = 0;
+    int resampled_pixels = 0;
+};
+
+//Time stb's PNG encoder takes for a width x height result, to be kept free at the end of a deadline
+//Measured on a desktop core like the constants of estimate_job_cost(); encoding is far slower than decoding.
+DeadlineClock::duration predicted_encode_time(int width, int height) {
+    double nanoseconds = 300.0 * width * height;
+    return std::chrono::duration_cast<DeadlineClock::duration>(std::chrono::duration<double, std::nano>(nanoseconds));
+}
+
+//True if a and b share no pixel and keep the same side of each other in every row
+bool seams_disjoint(const std::vector<int>& a, const std::vector<int>& b, int height) {
+    bool left = a[0] < b[0];
+    for (int y = 0; y < height; y++) {
+        if (a[y] == b[y] || (a[y] < b[y]) != left) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//Removes up to max_count of the lightest seams of one generate_seams() pass that neither touch nor cross each other
+//Such seams keep their order in every row, so each row is compacted in a single sweep. Returns the number removed
+int remove_seams_batch(unsigned int* img, std::vector<std::vector<int>>& seams, const std::vector<int>& seam_weights, std::vector<unsigned short>& energy,
+                       int& width, int height, int raw_width, int max_count, EnergyKind kind = EnergyKind::gradient,
+                       unsigned short* diagonal = nullptr) {
+    std::vector<int> candidates;
+    for (int x = 0; x < width; x++) {
+        if (seam_weights[x] != INT32_MAX) {
+            candidates.push_back(x);
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [&](int a, int b) { return seam_weights[a] < seam_weights[b]; });
+
+    std::vector<int> chosen;
+    for (int candidate : candidates) {
+        if (static_cast<int>(chosen.size()) >= max_count) {
+            break;
+        }
+        bool disjoint = std::all_of(chosen.begin(), chosen.end(), [&](int other) {
+            return seams_disjoint(seams[candidate], seams[other], height);
+        });
+        if (disjoint) {
+            chosen.push_back(candidate);
+        }
+    }
+    int count = static_cast<int>(chosen.size());
+    if (count == 0) {
+        return 0;
+    }
+    std::sort(chosen.begin(), chosen.end());
+
+    for (int y = 0; y < height; y++) {
+        int row = compute_offset(0, y, raw_width, 1);
+        int target = seams[chosen[0]][y];
+        for (int i = 0; i < count; i++) {
+            int from = seams[chosen[i]][y] + 1;
+            int to = i + 1 < count ? seams[chosen[i + 1]][y] : width;
+            memmove(&img[row + target], &img[row + from], (to - from) * sizeof(unsigned int));
+            memmove(&energy[row + target], &energy[row + from], (to - from) * sizeof(unsigned short));
+            if (diagonal != nullptr) {
+                memmove(&diagonal[row + target], &diagonal[row + from], (to - from) * sizeof(unsigned short));
+            }
+            target += to - from;
+        }
+    }
+    width -= count;
+
+    //Seams in the coordinates of the compacted rows
+    std::vector<int> shifted(height);
+    for (int i = 0; i < count; i++) {
+        for (int y = 0; y < height; y++) {
+            shifted[y] = seams[chosen[i]][y] - i;
+        }
+        recalculate_energy_at_seam(energy, img, width, height, raw_width, shifted, kind, diagonal);
+    }
+    log_trace() << "Removed " << count << " seams at once, new width: " << width;
+    return count;
+}
+
+//Linearly resamples every row from width down to target pixels, in place
+//The energy map is left stale, so this can only be the last step of a carve
+void resample_rows(unsigned int* img, int& width, int height, int raw_width, int target) {
+    double scale = static_cast<double>(width) / target;
+    for (int y = 0; y < height; y++) {
+        unsigned int* row = img + compute_offset(0, y, raw_width, 1);
+        //Every source position is at or right of x, so the row can be overwritten from the left
+        for (int x = 0; x < target; x++) {
+            double source = std::max(0.0, (x + 0.5) * scale - 0.5);
+            int left = std::min(static_cast<int>(source), width - 1);
+            int right = std::min(left + 1, width - 1);
+            double weight = source - left;
+
+            unsigned int a = row[left];
+            unsigned int b = row[right];
+            unsigned int value = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                double channel = ((a >> shift) & 0xFF) * (1 - weight) + ((b >> shift) & 0xFF) * weight;
+                value |= static_cast<unsigned int>(channel + 0.5) << shift;
+            }
+            row[x] = value;
+        }
+    }
+    width = target;
+}
+
+//Removes n seams from an image prepared by prepare_carve(), falling back to cheaper strategies when the
+//deadline is at risk. After every pass the rest of the carve is projected from the time passes take: if one seam
+//per search would not finish in time, as many seams are removed per search as needed, and if a search does not turn
+//up that many disjoint seams, the remaining width is resampled. 10% of the time left is kept in reserve.
+//Of the options only cancel, on_progress and metrics apply; removal and recalculation are reported together as compaction. Returns false if cancelled, img is then carved as far as it got
+bool carve_with_deadline(unsigned int* img, int& width, int height, int raw_width, int n, int seam_count, CarveWorkspace& workspace,
+                         DeadlineClock::time_point deadline, DeadlineReport& report, const CarveOptions& options = {}) {
+    std::vector<std::vector<int>>& seams = workspace.seams;
+    std::vector<int>& seam_weights = workspace.seam_weights;
+    seams.resize(width);
+    seam_weights.assign(width, 0);
+
+    //Moving average of a seam search plus its removal, zero until the first pass measured it
+    //A batch costs about as much as a single seam, since all of its seams go in the same sweep over the rows.
+    double pass_ms = 0;
+    int batch = 1;
+    //Disjoint seams the last search turned up when asked for more
+    int achievable = INT_MAX;
+    int removed = 0;
+    auto started = DeadlineClock::now();
+
+    while (removed < n) {
+        if (options.cancel != nullptr && options.cancel->is_cancelled()) {
+            return false;
+        }
+        int remaining = n - removed;
+        double left_ms = 0.9 * std::chrono::duration<double, std::milli>(deadline - DeadlineClock::now()).count();
+        if (left_ms <= 0) {
+            break;
+        }
+        if (pass_ms > 0) {
+            double needed = std::ceil(remaining * pass_ms / left_ms);
+            if (needed > achievable) {
+                break;
+            }
+            batch = std::max(1, static_cast<int>(needed));
+        }
+
+        TraceSpan pass_span("pass");
+        PhaseMark start = mark_phase(options.metrics);
+        generate_seams(seams, seam_weights, workspace.energy, width, height, raw_width, seam_count, options.cancel, workspace.diagonal_map());
+        if (options.cancel != nullptr && options.cancel->is_cancelled()) {
+            return false;
+        }
+        PhaseMark searched = mark_phase(options.metrics);
+        int count;
+        if (batch == 1) {
+            remove_seam(img, seams, seam_weights, workspace.energy, width, height, raw_width, workspace.energy_kind, workspace.diagonal_map());
+            count = 1;
+            report.exact_seams++;
+        }
+        else {
+            int wanted = std::min(batch, remaining);
+            count = remove_seams_batch(img, seams, seam_weights, workspace.energy, width, height, raw_width, wanted, workspace.energy_kind,
+                                       workspace.diagonal_map());
+            achievable = count < wanted ? count : INT_MAX;
+            report.batch_seams += count;
+            report.strategy = CarveStrategy::batch;
+        }
+        PhaseMark end = mark_phase(options.metrics);
+
+        double pass = milliseconds_between(start, end);
+        pass_ms = pass_ms > 0 ? 0.7 * pass_ms + 0.3 * pass : pass;
+        removed += count;
+        if (options.metrics != nullptr) {
+            options.metrics->add(Phase::seam_search, start, searched);
+            options.metrics->add(Phase::compaction, searched, end);
+            //Seams of a batch share the pass, its allocations are counted with the first
+            for (int i = 0; i < count; i++) {
+                options.metrics->add_seam(pass / count, i == 0 ? end.allocations - start.allocations : 0);
+            }
+        }
+        if (options.on_progress) {
+            options.on_progress(removed, n, milliseconds_between(started, end.time));
+        }
+        if (count == 0) {
+            break;
+        }
+    }
+
+    if (removed < n) {
+        report.resampled_pixels = n - removed;
+        report.strategy = CarveStrategy::resample;
+        PhaseTimer resample_timer(options.metrics, Phase::compaction);
+        resample_rows(img, width, height, raw_width, width - (n - removed));
+        resample_timer.stop();
+        if (options.on_progress) {
+            options.on_progress(n, n, std::chrono::duration<double, std::milli>(DeadlineClock::now() - started).count());
+        }
+    }
+    return true;
+}
+
+#endif //SEAMCARVING_DEADLINE_H
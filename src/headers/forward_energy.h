@@ -0,0 +1,124 @@
+#ifndef SEAMCARVING_FORWARD_ENERGY_H
+#define SEAMCARVING_FORWARD_ENERGY_H
+
+#include "luma.h"
+#include <cstdlib>
+
+//Row kernels of ForwardEnergy (see main.h), on rows of luma
+//Every cost is the absolute difference of two luma values and so fits a byte.
+
+//C_U of count pixels, where current points at the first one and current[-1] and current[count] are read as well
+void forward_energy_row_scalar(unsigned short* out, const unsigned char* current, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = std::abs(current[i+1] - current[i-1]);
+    }
+}
+
+//Diagonal costs of count pixels with a neighbour in the row above on either side, the left step in the low byte and the
+//right step in the high one; upper points at the pixel above the first one
+void forward_diagonal_row_scalar(unsigned short* out, const unsigned char* upper, const unsigned char* current, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = std::abs(upper[i-1] - current[i]) | (std::abs(upper[i+1] - current[i]) << 8);
+    }
+}
+
+#ifdef SEAMCARVING_X86
+
+//|a - b| of unsigned bytes, one of the two saturating differences is always 0
+__m128i absolute_difference_sse2(__m128i a, __m128i b) {
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+//16 pixels per iteration
+void forward_energy_row_sse2(unsigned short* out, const unsigned char* current, int count) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + i - 1));
+        __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + i + 1));
+        __m128i cost = absolute_difference_sse2(left, right);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi8(cost, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(cost, zero));
+    }
+    forward_energy_row_scalar(out + i, current + i, count - i);
+}
+
+//16 pixels per iteration; interleaving the left and right costs byte by byte packs them as the map stores them
+void forward_diagonal_row_sse2(unsigned short* out, const unsigned char* upper, const unsigned char* current, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i below = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + i));
+        __m128i left = absolute_difference_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(upper + i - 1)), below);
+        __m128i right = absolute_difference_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(upper + i + 1)), below);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi8(left, right));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(left, right));
+    }
+    forward_diagonal_row_scalar(out + i, upper + i, current + i, count - i);
+}
+
+__attribute__((target("avx2"))) __m256i absolute_difference_avx2(__m256i a, __m256i b) {
+    return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+}
+
+//32 pixels per iteration
+//The unpacks work per 128 bit lane, so the 64 bit quarters are put in the order 0 2 1 3 beforehand.
+__attribute__((target("avx2"))) void forward_energy_row_avx2(unsigned short* out, const unsigned char* current, int count) {
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current + i - 1));
+        __m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current + i + 1));
+        __m256i cost = _mm256_permute4x64_epi64(absolute_difference_avx2(left, right), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_unpacklo_epi8(cost, zero));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_unpackhi_epi8(cost, zero));
+    }
+    forward_energy_row_sse2(out + i, current + i, count - i);
+}
+
+__attribute__((target("avx2"))) void forward_diagonal_row_avx2(unsigned short* out, const unsigned char* upper, const unsigned char* current, int count) {
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i below = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current + i));
+        __m256i left = absolute_difference_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(upper + i - 1)), below);
+        __m256i right = absolute_difference_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(upper + i + 1)), below);
+        left = _mm256_permute4x64_epi64(left, _MM_SHUFFLE(3, 1, 2, 0));
+        right = _mm256_permute4x64_epi64(right, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_unpacklo_epi8(left, right));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_unpackhi_epi8(left, right));
+    }
+    forward_diagonal_row_sse2(out + i, upper + i, current + i, count - i);
+}
+
+#endif //SEAMCARVING_X86
+
+using ForwardEnergyRow = void (*)(unsigned short* out, const unsigned char* current, int count);
+using ForwardDiagonalRow = void (*)(unsigned short* out, const unsigned char* upper, const unsigned char* current, int count);
+
+//The widest kernels this CPU runs, picked once
+ForwardEnergyRow forward_energy_row_kernel() {
+#ifdef SEAMCARVING_X86
+    static const ForwardEnergyRow kernel = __builtin_cpu_supports("avx2") ? forward_energy_row_avx2 : forward_energy_row_sse2;
+    return kernel;
+#else
+    return forward_energy_row_scalar;
+#endif
+}
+
+ForwardDiagonalRow forward_diagonal_row_kernel() {
+#ifdef SEAMCARVING_X86
+    static const ForwardDiagonalRow kernel = __builtin_cpu_supports("avx2") ? forward_diagonal_row_avx2 : forward_diagonal_row_sse2;
+    return kernel;
+#else
+    return forward_diagonal_row_scalar;
+#endif
+}
+
+void forward_energy_row(unsigned short* out, const unsigned char* current, int count) {
+    forward_energy_row_kernel()(out, current, count);
+}
+
+void forward_diagonal_row(unsigned short* out, const unsigned char* upper, const unsigned char* current, int count) {
+    forward_diagonal_row_kernel()(out, upper, current, count);
+}
+
+#endif //SEAMCARVING_FORWARD_ENERGY_H
@@ -0,0 +1,273 @@
+#ifndef SEAMCARVING_IMAGE_CACHE_H
+#define SEAMCARVING_IMAGE_CACHE_H
+
+#include "main.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+//64 bit xxHash (XXH64) of the input bytes, fast enough to run over every request
+uint64_t hash_bytes(const unsigned char* data, size_t size, uint64_t seed = 0) {
+    const uint64_t prime1 = 11400714785074694791ULL;
+    const uint64_t prime2 = 14029467366897019727ULL;
+    const uint64_t prime3 = 1609587929392839161ULL;
+    const uint64_t prime4 = 9650029242287828579ULL;
+    const uint64_t prime5 = 2870177450012600261ULL;
+
+    auto rotate = [](uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); };
+    auto read64 = [](const unsigned char* p) { uint64_t value; memcpy(&value, p, 8); return value; };
+    auto read32 = [](const unsigned char* p) { uint32_t value; memcpy(&value, p, 4); return value; };
+    auto round = [&](uint64_t accumulator, uint64_t input) { return rotate(accumulator + input * prime2, 31) * prime1; };
+    auto merge = [&](uint64_t accumulator, uint64_t value) { return (accumulator ^ round(0, value)) * prime1 + prime4; };
+
+    const unsigned char* p = data;
+    const unsigned char* end = data + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        hash = rotate(v1, 1) + rotate(v2, 7) + rotate(v3, 12) + rotate(v4, 18);
+        hash = merge(hash, v1);
+        hash = merge(hash, v2);
+        hash = merge(hash, v3);
+        hash = merge(hash, v4);
+    }
+    else {
+        hash = seed + prime5;
+    }
+
+    hash += size;
+    for (; p + 8 <= end; p += 8) {
+        hash = rotate(hash ^ round(0, read64(p)), 27) * prime1 + prime4;
+    }
+    if (p + 4 <= end) {
+        hash = rotate(hash ^ (read32(p) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash = rotate(hash ^ (*p * prime5), 11) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+//Decoded image together with the state prepare_carve() derives from it
+struct CachedImage {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned int> pixels;
+    std::vector<unsigned short> energy;
+    std::vector<unsigned short> diagonal;
+
+    size_t bytes() const {
+        return pixels.size() * sizeof(unsigned int) + (energy.size() + diagonal.size()) * sizeof(unsigned short);
+    }
+};
+
+//LRU cache of decoded and prepared images keyed by the hash of the encoded input bytes
+//Lives in memory; with a directory set, entries are also written there and survive restarts.
+//Disk entries are <hash>.scc files: "SCC3", width, height and whether a diagonal map follows as uint32, then packed
+//pixels, energy and the diagonal map of forward energy if there is one.
+class ImageCache {
+public:
+    ImageCache(size_t capacity_bytes, std::string directory) : capacity(capacity_bytes), directory(std::move(directory)) {
+        if (!this->directory.empty()) {
+            std::filesystem::create_directories(this->directory);
+        }
+    }
+
+    std::shared_ptr<const CachedImage> find(uint64_t key) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                order.splice(order.begin(), order, it->second);
+                hits++;
+                return it->second->second;
+            }
+        }
+
+        std::shared_ptr<const CachedImage> image = load(key);
+        if (image != nullptr) {
+            disk_hits++;
+            remember(key, image);
+            return image;
+        }
+        misses++;
+        return nullptr;
+    }
+
+    void insert(uint64_t key, std::shared_ptr<const CachedImage> image) {
+        remember(key, image);
+        store(key, *image);
+    }
+
+    //Counters in the key=value form of the daemon protocol
+    std::string stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return "cache_hits=" + std::to_string(hits.load()) + " cache_disk_hits=" + std::to_string(disk_hits.load())
+            + " cache_misses=" + std::to_string(misses.load()) + " cache_entries=" + std::to_string(entries.size())
+            + " cache_bytes=" + std::to_string(used);
+    }
+
+private:
+    using Entry = std::pair<uint64_t, std::shared_ptr<const CachedImage>>;
+
+    void remember(uint64_t key, const std::shared_ptr<const CachedImage>& image) {
+        if (image->bytes() > capacity) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.count(key)) {
+            return;
+        }
+        order.emplace_front(key, image);
+        entries[key] = order.begin();
+        used += image->bytes();
+
+        while (used > capacity) {
+            used -= order.back().second->bytes();
+            entries.erase(order.back().first);
+            order.pop_back();
+        }
+    }
+
+    std::string file_for(uint64_t key) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.scc", static_cast<unsigned long long>(key));
+        return (std::filesystem::path(directory) / name).string();
+    }
+
+    //Written to a temporary name first so concurrent readers never see half a file
+    void store(uint64_t key, const CachedImage& image) {
+        if (directory.empty()) {
+            return;
+        }
+        std::string path = file_for(key);
+        std::string temporary = path + ".tmp" + std::to_string(reinterpret_cast<uintptr_t>(&image));
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if (file == nullptr) {
+            return;
+        }
+        uint32_t header[4] = {0x33434353, static_cast<uint32_t>(image.width), static_cast<uint32_t>(image.height), !image.diagonal.empty()};
+        bool ok = fwrite(header, sizeof(header), 1, file) == 1
+            && fwrite(image.pixels.data(), sizeof(unsigned int), image.pixels.size(), file) == image.pixels.size()
+            && fwrite(image.energy.data(), sizeof(unsigned short), image.energy.size(), file) == image.energy.size()
+            && fwrite(image.diagonal.data(), sizeof(unsigned short), image.diagonal.size(), file) == image.diagonal.size();
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+            remove(temporary.c_str());
+        }
+    }
+
+    std::shared_ptr<const CachedImage> load(uint64_t key) const {
+        if (directory.empty()) {
+            return nullptr;
+        }
+        FILE* file = fopen(file_for(key).c_str(), "rb");
+        if (file == nullptr) {
+            return nullptr;
+        }
+        auto image = std::make_shared<CachedImage>();
+        uint32_t header[4];
+        bool ok = fread(header, sizeof(header), 1, file) == 1 && header[0] == 0x33434353 && header[1] > 0 && header[2] > 0 && header[3] <= 1;
+        if (ok) {
+            image->width = static_cast<int>(header[1]);
+            image->height = static_cast<int>(header[2]);
+            size_t pixels = static_cast<size_t>(image->width) * image->height;
+            image->pixels.resize(pixels);
+            image->energy.resize(pixels);
+            image->diagonal.resize(header[3] ? pixels : 0);
+            ok = fread(image->pixels.data(), sizeof(unsigned int), pixels, file) == pixels
+                && fread(image->energy.data(), sizeof(unsigned short), pixels, file) == pixels
+                && fread(image->diagonal.data(), sizeof(unsigned short), image->diagonal.size(), file) == image->diagonal.size();
+        }
+        fclose(file);
+        return ok ? image : nullptr;
+    }
+
+    size_t capacity;
+    std::string directory;
+    std::mutex mutex;
+    std::list<Entry> order;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+    size_t used = 0;
+    std::atomic<unsigned long> hits{0};
+    std::atomic<unsigned long> disk_hits{0};
+    std::atomic<unsigned long> misses{0};
+};
+
+bool read_whole_file(const std::string& path, std::vector<unsigned char>& bytes) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = fseek(file, 0, SEEK_END) == 0;
+    long size = ok ? ftell(file) : -1;
+    ok = size >= 0 && fseek(file, 0, SEEK_SET) == 0;
+    if (ok) {
+        bytes.resize(size);
+        ok = fread(bytes.data(), 1, size, file) == static_cast<size_t>(size);
+    }
+    fclose(file);
+    return ok;
+}
+
+//Fills the workspace with the decoded and prepared input, from the cache if it has seen the same bytes before
+//key is hash_bytes() of the input. Returns an error message, or an empty string on success
+//The energy map depends on the workspace's energy_kind, so entries are keyed by both; gradient entries keep the plain hash.
+std::string load_prepared(const unsigned char* input, size_t size, uint64_t key, ImageCache* cache, CarveWorkspace& workspace,
+                          int& width, int& height) {
+    key ^= static_cast<uint64_t>(workspace.energy_kind) * 0x9E3779B97F4A7C15ULL;
+    if (cache != nullptr) {
+        if (auto cached = cache->find(key)) {
+            width = cached->width;
+            height = cached->height;
+            workspace.pixels = cached->pixels;
+            workspace.energy = cached->energy;
+            workspace.diagonal = cached->diagonal;
+            return "";
+        }
+    }
+
+    int channels;
+    unsigned char* raw_img = stbi_load_from_memory(input, static_cast<int>(size), &width, &height, &channels, 4);
+    if (raw_img == nullptr) {
+        return std::string("cannot decode input: ") + stbi_failure_reason();
+    }
+    prepare_carve_rgba(raw_img, width, height, workspace);
+    stbi_image_free(raw_img);
+
+    if (cache != nullptr) {
+        auto entry = std::make_shared<CachedImage>();
+        entry->width = width;
+        entry->height = height;
+        entry->pixels = workspace.pixels;
+        entry->energy = workspace.energy;
+        entry->diagonal = workspace.diagonal;
+        cache->insert(key, std::move(entry));
+    }
+    return "";
+}
+
+#endif //SEAMCARVING_IMAGE_CACHE_H
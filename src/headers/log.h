@@ -0,0 +1,99 @@
+#ifndef SEAMCARVING_LOG_H
+#define SEAMCARVING_LOG_H
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+//error: failures, info: one line per image or request, debug: steps and totals of a carve, trace: every seam
+enum class LogLevel {
+    error,
+    info,
+    debug,
+    trace
+};
+
+std::atomic<int>& log_threshold() {
+    static std::atomic<int> threshold{static_cast<int>(LogLevel::info)};
+    return threshold;
+}
+
+void set_log_level(LogLevel level) {
+    log_threshold().store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+bool log_enabled(LogLevel level) {
+    return static_cast<int>(level) <= log_threshold().load(std::memory_order_relaxed);
+}
+
+bool parse_log_level(const std::string& name, LogLevel& level) {
+    const char* names[] = {"error", "info", "debug", "trace"};
+    for (int i = 0; i < 4; i++) {
+        if (name == names[i]) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+//One line of log output, written as a whole when it goes out of scope so lines of different threads never mix
+//Nothing is formatted for disabled levels. Errors go to stderr; the rest goes to stdout, which is only flushed
+//for info lines, so debug and trace output stays buffered.
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) : level(level) {
+        if (log_enabled(level)) {
+            buffer = std::make_unique<std::ostringstream>();
+        }
+    }
+
+    ~LogLine() {
+        if (buffer == nullptr) {
+            return;
+        }
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ostream& out = level == LogLevel::error ? std::cerr : std::cout;
+        out << buffer->str() << '\n';
+        if (level == LogLevel::info) {
+            out.flush();
+        }
+    }
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    template<typename T>
+    LogLine& operator<<(const T& value) {
+        if (buffer != nullptr) {
+            *buffer << value;
+        }
+        return *this;
+    }
+
+private:
+    LogLevel level;
+    std::unique_ptr<std::ostringstream> buffer;
+};
+
+LogLine log_error() {
+    return LogLine(LogLevel::error);
+}
+
+LogLine log_info() {
+    return LogLine(LogLevel::info);
+}
+
+LogLine log_debug() {
+    return LogLine(LogLevel::debug);
+}
+
+LogLine log_trace() {
+    return LogLine(LogLevel::trace);
+}
+
+#endif //SEAMCARVING_LOG_H
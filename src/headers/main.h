@@ -1,23 +1,43 @@
 #ifndef SEAMCARVING_MAIN_H
 #define SEAMCARVING_MAIN_H
 
+#include "allocations.h"
+#define STBI_MALLOC(size) tracked_malloc(size)
+#define STBI_REALLOC(block, size) tracked_realloc(block, size)
+#define STBI_FREE(block) tracked_free(block)
+#define STBIW_MALLOC(size) tracked_malloc(size)
+#define STBIW_REALLOC(block, size) tracked_realloc(block, size)
+#define STBIW_FREE(block) tracked_free(block)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#include "log.h"
+#include "luma.h"
+#include "color_energy.h"
+#include "forward_energy.h"
+#include "stencil_energy.h"
+#include "metrics.h"
 #include <iostream>
 #include <vector>
 #include <cmath>
 #include <chrono>
 #include <algorithm>
+#include <cstring>
+#include <functional>
+#include <atomic>
+#include <string>
 
 int compute_offset(int x, int y, int width, int channels) {
     return (y * width + x) * channels;
 }
 
 //Takes image as unsigned char array and converts to unsigned int array
-unsigned int* convert_to_int(const unsigned char* img, int width, int height, int channels) {
-    auto* ret = (unsigned int*) malloc(width*height* sizeof(unsigned int));
+//Writes into ret if given, otherwise allocates the result
+unsigned int* convert_to_int(const unsigned char* img, int width, int height, int channels, unsigned int* ret = nullptr) {
+    if (ret == nullptr) {
+        ret = (unsigned int*) tracked_malloc(width*height* sizeof(unsigned int));
+    }
 
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
@@ -41,7 +61,7 @@ unsigned int* convert_to_int(const unsigned char* img, int width, int height, in
 
 //Takes image as unsigned int array and converts to unsigned char array
 unsigned char* convert_to_char(const unsigned int* img, int width, int height, int targetChannels) {
-    auto* ret = (unsigned char*) malloc(width*height*targetChannels*sizeof(unsigned char));
+    auto* ret = (unsigned char*) tracked_malloc(width*height*targetChannels*sizeof(unsigned char));
 
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
@@ -63,37 +83,30 @@ unsigned char* convert_to_char(const unsigned int* img, int width, int height, i
 
 //returns grayscale value of pixel at input coordinates x, y
 unsigned char get_grayscale_value(int x, int y, const unsigned int* img, int raw_width) {
-    int position = compute_offset(x, y, raw_width, 1);
-    unsigned int value = img[position];
-
-    int red = value % 256;
-    value /= 256;
-    int green = value % 256;
-    value /= 256;
-    int blue = value % 256;
-
-    return static_cast<unsigned char>(0.299 * red + 0.587 * green + 0.114 * blue);
+    return luma(img[compute_offset(x, y, raw_width, 1)]);
 }
 
 //returns unsigned char array with grayscale pixel values from input int array
-unsigned char* grayscale(unsigned int* img, int width, int height, int raw_width) {
-    auto* grayscale = (unsigned char*) malloc(width*height*sizeof(unsigned char));
+//Writes into grayscale if given, otherwise allocates the result
+unsigned char* grayscale(unsigned int* img, int width, int height, int raw_width, unsigned char* grayscale = nullptr) {
+    if (grayscale == nullptr) {
+        grayscale = (unsigned char*) tracked_malloc(width*height*sizeof(unsigned char));
+    }
 
     for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int position = compute_offset(x, y, width, 1);
-            grayscale[position] = get_grayscale_value(x, y, img, raw_width);
-        }
+        luma_row(&img[compute_offset(0, y, raw_width, 1)], &grayscale[compute_offset(0, y, width, 1)], width);
     }
 
     return grayscale;
 }
 
-unsigned short gradient_magnitude(int x, int y, const unsigned char* grayscale, int raw_width) {
-    unsigned char left_pixel_grayscale = grayscale[compute_offset(x-1, y, raw_width, 1)];
-    unsigned char right_pixel_grayscale = grayscale[compute_offset(x+1, y, raw_width, 1)];
-    unsigned char upper_pixel_grayscale = grayscale[compute_offset(x, y-1, raw_width, 1)];
-    unsigned char lower_pixel_grayscale = grayscale[compute_offset(x, y+1, raw_width, 1)];
+//Gradient of the luma around x, y, computed on demand from the packed pixels
+//Only the pixels next to a removed seam need it, which is why no grayscale copy of the image is kept.
+unsigned short gradient_magnitude(int x, int y, const unsigned int* img, int raw_width) {
+    unsigned char left_pixel_grayscale = get_grayscale_value(x-1, y, img, raw_width);
+    unsigned char right_pixel_grayscale = get_grayscale_value(x+1, y, img, raw_width);
+    unsigned char upper_pixel_grayscale = get_grayscale_value(x, y-1, img, raw_width);
+    unsigned char lower_pixel_grayscale = get_grayscale_value(x, y+1, img, raw_width);
 
     unsigned char horizontal_gradient = std::abs(right_pixel_grayscale - left_pixel_grayscale);
     unsigned char vertical_gradient = std::abs(upper_pixel_grayscale - lower_pixel_grayscale);
@@ -101,51 +114,354 @@ unsigned short gradient_magnitude(int x, int y, const unsigned char* grayscale,
     return horizontal_gradient + vertical_gradient;
 }
 
-//Takes image as one-channel unsigned char array in grayscale
-//returns vector describing the images energy map using a simple gradient function, with higher value meaning more significant pixel.
-//note: The resulting vector will consist of only one channel
-void generate_energy_map(std::vector<unsigned short>& energy, unsigned char* grayscale, int width, int height, int raw_width) {
+//Energy functions a carve can run with, in the order of energy_registry below
+enum class EnergyKind {
+    gradient,
+    color,
+    forward,
+    sobel,
+    scharr,
+    laplacian,
+    entropy
+};
+
+//Energy policies, passed as template arguments so that each one is compiled into the loops that run it
+//generate_energy_rows() hands a policy every row of the image in order through add_row(), and asks it for the interior
+//pixels of a row through energy_row() once the row below has been added; that is the full map kernel.
+//strip() is the incremental one: the energy of pixels first to last of a row, all interior, after a seam was removed.
+//reach is how many rows above and below a seam the pixels are that the policy reads, and so how far the strip of
+//pixels whose energy changes with a removal widens. Policies with diagonal_costs also fill a second map through
+//diagonal_row(), see ForwardEnergy.
+
+//Gradient of the luma, which it keeps for a window of three rows
+class GradientEnergy {
+public:
+    explicit GradientEnergy(int width) : width(width), window(3 * width) {}
+
+    void add_row(const unsigned int* row, int y) {
+        luma_row(row, &window[(y % 3) * width], width);
+    }
 
-    //Calculate gradient magnitude for all non-border pixels
-    for (int y = 1; y < height-1; y++) {
+    void energy_row(unsigned short* energy_row, const unsigned int*, int, int y) {
+        const unsigned char* upper = &window[((y + 2) % 3) * width];
+        const unsigned char* current = &window[(y % 3) * width];
+        const unsigned char* lower = &window[((y + 1) % 3) * width];
+        //gradient_magnitude() of every pixel, on row pointers so that the compiler vectorizes it
         for (int x = 1; x < width-1; x++) {
-            energy[compute_offset(x, y, width, 1)] = gradient_magnitude(x, y, grayscale, raw_width);
+            energy_row[x] = std::abs(current[x+1] - current[x-1]) + std::abs(upper[x] - lower[x]);
         }
     }
 
-    //Set borders to max_value
-    for (int y = 0; y < height; y++) {
-        energy[compute_offset(0, y, raw_width, 1)] = UINT16_MAX;
-        energy[compute_offset(width-1, y, raw_width, 1)] = UINT16_MAX;
+    static constexpr bool diagonal_costs = false;
+    //The pixels above and below count as well, but only those next to the seam are recalculated
+    static constexpr int reach = 0;
+
+    static void strip(unsigned short* energy_row, const unsigned int* img, int raw_width, int y, int first, int last) {
+        for (int x = first; x <= last; x++) {
+            energy_row[x] = gradient_magnitude(x, y, img, raw_width);
+        }
+    }
+
+private:
+    int width;
+    std::vector<unsigned char> window;
+};
+
+//Dual gradient on the colour channels, straight from the packed pixels (see color_energy.h)
+class ColorEnergy {
+public:
+    explicit ColorEnergy(int width) : width(width) {}
+
+    void add_row(const unsigned int*, int) {}
+
+    void energy_row(unsigned short* energy_row, const unsigned int* row, int raw_width, int) {
+        color_energy_row(energy_row + 1, row - raw_width + 1, row + 1, row + raw_width + 1, width - 2);
+    }
+
+    static constexpr bool diagonal_costs = false;
+    static constexpr int reach = 0;
+
+    static void strip(unsigned short* energy_row, const unsigned int* img, int raw_width, int y, int first, int last) {
+        const unsigned int* row = &img[compute_offset(0, y, raw_width, 1)];
+        color_energy_row_scalar(energy_row + first, row - raw_width + first, row + first, row + raw_width + first, last - first + 1);
+    }
+
+private:
+    int width;
+};
+
+//Forward energy (Rubinstein et al.): the cost of the edges a removal creates instead of the energy of what it removes
+//The energy map holds C_U, the luma difference of the left and right neighbours that meet once the pixel is gone.
+//A seam stepping diagonally also makes a pixel of the row above the new neighbour of one below; that part of C_L and
+//C_R goes to the diagonal map, which build_seam() adds to the steps to the left and right. Both maps come out of the
+//same sweep over the rows, from the luma the vector kernels take of each row.
+class ForwardEnergy {
+public:
+    explicit ForwardEnergy(int width) : width(width), window(3 * width) {}
+
+    void add_row(const unsigned int* row, int y) {
+        luma_row(row, &window[(y % 3) * width], width);
+    }
+
+    void energy_row(unsigned short* energy_row, const unsigned int*, int, int y) {
+        forward_energy_row(energy_row + 1, &window[(y % 3) * width] + 1, width - 2);
+    }
+
+    //Diagonal costs of the steps from every pixel of row y, y > 0, see diagonal_at()
+    void diagonal_row(unsigned short* diagonal_row, int y) {
+        const unsigned char* upper = &window[((y + 2) % 3) * width];
+        const unsigned char* current = &window[(y % 3) * width];
+        if (width == 1) {
+            diagonal_row[0] = 0;
+            return;
+        }
+        diagonal_row[0] = std::abs(upper[1] - current[0]) << 8;
+        forward_diagonal_row(diagonal_row + 1, upper + 1, current + 1, width - 2);
+        diagonal_row[width-1] = std::abs(upper[width-2] - current[width-1]);
+    }
+
+    static constexpr bool diagonal_costs = true;
+    static constexpr int reach = 0;
+
+    static void strip(unsigned short* energy_row, const unsigned int* img, int raw_width, int y, int first, int last) {
+        for (int x = first; x <= last; x++) {
+            energy_row[x] = std::abs(get_grayscale_value(x+1, y, img, raw_width) - get_grayscale_value(x-1, y, img, raw_width));
+        }
+    }
+
+    //What a seam pays on top of C_U for stepping from pixel x of row y-1 to x-1 (low byte) or x+1 (high byte) of row y
+    //Either way pixel x of row y ends up below the pixel the seam stepped towards in the row above.
+    static unsigned short diagonal_at(int x, int y, int width, const unsigned int* img, int raw_width) {
+        unsigned char below = get_grayscale_value(x, y, img, raw_width);
+        int left = x > 0 ? std::abs(get_grayscale_value(x-1, y-1, img, raw_width) - below) : 0;
+        int right = x < width-1 ? std::abs(get_grayscale_value(x+1, y-1, img, raw_width) - below) : 0;
+        return left | (right << 8);
+    }
+
+private:
+    int width;
+    std::vector<unsigned char> window;
+};
+
+//Policy of a 3x3 Filter on the luma (see stencil_energy.h), which it keeps for a window of three rows
+//Filter::row() is inlined into both kernels, so each filter gets loops of its own.
+template <typename Filter>
+class LumaStencil {
+public:
+    explicit LumaStencil(int width) : width(width), window(3 * width) {}
+
+    void add_row(const unsigned int* row, int y) {
+        luma_row(row, &window[(y % 3) * width], width);
+    }
+
+    void energy_row(unsigned short* energy_row, const unsigned int*, int, int y) {
+        const unsigned char* upper = &window[((y + 2) % 3) * width];
+        const unsigned char* current = &window[(y % 3) * width];
+        const unsigned char* lower = &window[((y + 1) % 3) * width];
+        Filter::row(energy_row + 1, upper + 1, current + 1, lower + 1, width - 2);
+    }
+
+    static constexpr bool diagonal_costs = false;
+    static constexpr int reach = 1;
+
+    //Takes the luma of the three rows once per pixel of the strip and one beyond either end, in chunks on the stack
+    static void strip(unsigned short* energy_row, const unsigned int* img, int raw_width, int y, int first, int last) {
+        const int chunk = 16;
+        unsigned char rows[3][chunk + 2];
+        for (int start = first; start <= last; start += chunk) {
+            int end = std::min(last, start + chunk - 1);
+            for (int i = 0; i < 3; i++) {
+                luma_row_scalar(&img[compute_offset(start - 1, y - 1 + i, raw_width, 1)], rows[i], end - start + 3);
+            }
+            Filter::row(energy_row + start, &rows[0][1], &rows[1][1], &rows[2][1], end - start + 1);
+        }
+    }
+
+private:
+    int width;
+    std::vector<unsigned char> window;
+};
+
+using SobelEnergy = LumaStencil<SobelFilter>;
+using ScharrEnergy = LumaStencil<ScharrFilter>;
+using LaplacianEnergy = LumaStencil<LaplacianFilter>;
+using EntropyEnergy = LumaStencil<EntropyFilter>;
+
+//Energy of rows first to last-1 of the packed image, with higher value meaning more significant pixel
+//A row's energy follows as soon as the row below it has been added to the policy.
+//rgba, if given, is a decoded RGBA image that is packed into img row by row along the way, so that conversion and
+//energy map share one pass; this writes rows just outside the range as well, so bands must not run concurrently then.
+//The first and last row stay at 0 apart from their borders.
+//diagonal, with the same layout as energy, receives the diagonal map of policies that have one.
+//convert_ms, if given, has the time spent packing rgba added to it, which the pass otherwise interleaves with the energy.
+template <typename Energy>
+void generate_energy_rows(std::vector<unsigned short>& energy, unsigned int* img, int width, int height, int raw_width, int first, int last,
+                          const unsigned char* rgba = nullptr, unsigned short* diagonal = nullptr, double* convert_ms = nullptr) {
+    Energy policy(width);
+    auto energy_of = [&](int y) {
+        unsigned short* energy_row = &energy[compute_offset(0, y, raw_width, 1)];
+        if (y == 0 || y == height-1) {
+            std::fill_n(energy_row, width, 0);
+        }
+        else {
+            policy.energy_row(energy_row, &img[compute_offset(0, y, raw_width, 1)], raw_width, y);
+        }
+
+        //Set borders to max_value
+        energy_row[0] = UINT16_MAX;
+        energy_row[width-1] = UINT16_MAX;
+
+        if constexpr (Energy::diagonal_costs) {
+            unsigned short* diagonal_row = &diagonal[compute_offset(0, y, raw_width, 1)];
+            if (y == 0) {
+                std::fill_n(diagonal_row, width, 0);
+            }
+            else {
+                policy.diagonal_row(diagonal_row, y);
+            }
+        }
+    };
+
+    for (int y = std::max(first - 1, 0); y <= std::min(last, height - 1); y++) {
+        unsigned int* row = &img[compute_offset(0, y, raw_width, 1)];
+        if (rgba != nullptr) {
+            auto convert_start = convert_ms != nullptr ? MetricsClock::now() : MetricsClock::time_point();
+            convert_to_int(&rgba[compute_offset(0, y, width, 4)], width, 1, 4, row);
+            if (convert_ms != nullptr) {
+                *convert_ms += milliseconds_between(convert_start, MetricsClock::now());
+            }
+        }
+        policy.add_row(row, y);
+        if (y-1 >= first) {
+            energy_of(y-1);
+        }
+    }
+    if (last == height && height-1 >= first) {
+        energy_of(height-1);
     }
 }
 
 //Take the same arguments as generate_energy_map as well as a seam.
 //Only recalculates energy for pixels affected by the removal of given seam
-void recalculate_energy_at_seam(std::vector<unsigned short>& energy, unsigned char* grayscale, const int width, const int height, const int raw_width, std::vector<int>& seam) {
+//The diagonal map changes wherever the seam left the rows above and below shifted against each other.
+template <typename Energy>
+void recalculate_energy_at_seam(std::vector<unsigned short>& energy, const unsigned int* img, const int width, const int height, const int raw_width, const std::vector<int>& seam,
+                                unsigned short* diagonal = nullptr) {
+    if constexpr (Energy::diagonal_costs) {
+        for (int y = 1; y < height; y++) {
+            int first = std::max(0, std::min(seam[y-1] - 1, seam[y]));
+            int last = std::min(width - 1, std::max(seam[y-1], seam[y] - 1));
+            for (int x = first; x <= last; x++) {
+                diagonal[compute_offset(x, y, raw_width, 1)] = Energy::diagonal_at(x, y, width, img, raw_width);
+            }
+        }
+    }
+
+    //The pixels left and right of the seam in its own row and, with a reach, in the rows around
     for (int y = 1; y < height - 1; y++) {
-        int x = seam[y];
-        int left_pixel_position = compute_offset(x-1, y, raw_width, 1);
-        int shifted_pixel_position = compute_offset(x, y, raw_width, 1);
+        int first = seam[y] - 1;
+        int last = seam[y];
+        for (int row = std::max(0, y - Energy::reach); row <= std::min(height - 1, y + Energy::reach); row++) {
+            first = std::min(first, seam[row] - 1);
+            last = std::max(last, seam[row]);
+        }
+        first = std::max(first, 0);
+        last = std::min(last, width - 1);
 
-        if (x > 1) {
-            energy[left_pixel_position] = gradient_magnitude(x-1, y, grayscale, raw_width);
+        unsigned short* energy_row = &energy[compute_offset(0, y, raw_width, 1)];
+        if (std::max(first, 1) <= std::min(last, width - 2)) {
+            Energy::strip(energy_row, img, raw_width, y, std::max(first, 1), std::min(last, width - 2));
         }
-        else {
-            energy[left_pixel_position] = UINT16_MAX;
+        //Set borders to max_value
+        if (first == 0) {
+            energy_row[0] = UINT16_MAX;
         }
-
-        if (x < width - 1) {
-            energy[shifted_pixel_position] = gradient_magnitude(x, y, grayscale, raw_width);
+        if (last == width - 1) {
+            energy_row[width-1] = UINT16_MAX;
         }
-        else {
-            energy[shifted_pixel_position] = UINT16_MAX;
+    }
+}
+
+//What a carve runs for one energy function, each entry compiled for its policy
+//A carve looks its functions up once per image or seam, never per pixel.
+struct EnergyFunctions {
+    const char* name;
+    void (*generate_rows)(std::vector<unsigned short>& energy, unsigned int* img, int width, int height, int raw_width, int first, int last,
+                          const unsigned char* rgba, unsigned short* diagonal, double* convert_ms);
+    void (*recalculate)(std::vector<unsigned short>& energy, const unsigned int* img, int width, int height, int raw_width, const std::vector<int>& seam,
+                        unsigned short* diagonal);
+    bool diagonal_costs;
+};
+
+template <typename Energy>
+constexpr EnergyFunctions energy_functions(const char* name) {
+    return {name, generate_energy_rows<Energy>, recalculate_energy_at_seam<Energy>, Energy::diagonal_costs};
+}
+
+//Indexed by EnergyKind; a new energy function is a policy, an entry here and a name in EnergyKind
+const EnergyFunctions energy_registry[] = {
+    energy_functions<GradientEnergy>("gradient"),
+    energy_functions<ColorEnergy>("color"),
+    energy_functions<ForwardEnergy>("forward"),
+    energy_functions<SobelEnergy>("sobel"),
+    energy_functions<ScharrEnergy>("scharr"),
+    energy_functions<LaplacianEnergy>("laplacian"),
+    energy_functions<EntropyEnergy>("entropy"),
+};
+
+const int energy_kind_count = std::size(energy_registry);
+static_assert(static_cast<int>(EnergyKind::entropy) == energy_kind_count - 1, "every EnergyKind needs an entry in energy_registry");
+
+const EnergyFunctions& energy_functions(EnergyKind kind) {
+    return energy_registry[static_cast<int>(kind)];
+}
+
+const char* energy_name(EnergyKind kind) {
+    return energy_functions(kind).name;
+}
+
+//"gradient, color, ..." for help and error messages
+std::string energy_names() {
+    std::string names;
+    for (const EnergyFunctions& functions : energy_registry) {
+        names += names.empty() ? functions.name : std::string(", ") + functions.name;
+    }
+    return names;
+}
+
+bool parse_energy(const std::string& name, EnergyKind& kind) {
+    for (int i = 0; i < energy_kind_count; i++) {
+        if (name == energy_name(static_cast<EnergyKind>(i))) {
+            kind = static_cast<EnergyKind>(i);
+            return true;
         }
     }
+    return false;
+}
+
+//diagonal is only written, and then required, for energies with diagonal_costs
+void generate_energy_rows(std::vector<unsigned short>& energy, unsigned int* img, int width, int height, int raw_width, int first, int last,
+                          EnergyKind kind, const unsigned char* rgba = nullptr, unsigned short* diagonal = nullptr, double* convert_ms = nullptr) {
+    energy_functions(kind).generate_rows(energy, img, width, height, raw_width, first, last, rgba, diagonal, convert_ms);
+}
+
+//returns the energy map of the whole packed image, see generate_energy_rows()
+//note: The resulting vector will consist of only one channel
+void generate_energy_map(std::vector<unsigned short>& energy, unsigned int* img, int width, int height, int raw_width, EnergyKind kind = EnergyKind::gradient,
+                         unsigned short* diagonal = nullptr) {
+    generate_energy_rows(energy, img, width, height, raw_width, 0, height, kind, nullptr, diagonal);
+}
+
+void recalculate_energy_at_seam(std::vector<unsigned short>& energy, const unsigned int* img, const int width, const int height, const int raw_width, const std::vector<int>& seam,
+                                EnergyKind kind = EnergyKind::gradient, unsigned short* diagonal = nullptr) {
+    energy_functions(kind).recalculate(energy, img, width, height, raw_width, seam, diagonal);
 }
 
 //Builds a seam by deciding on the lowest energy path through the image
-void build_seam(std::vector<int>& seam, std::vector<int>& seam_weights, const std::vector<unsigned short>& energy, int width, int height, const int raw_width) {
+//With diagonal_costs, diagonal, the map of a forward energy, adds its costs to the steps to the left and right.
+template <bool diagonal_costs>
+void build_seam(std::vector<int>& seam, std::vector<int>& seam_weights, const std::vector<unsigned short>& energy, int width, int height, const int raw_width,
+                const unsigned short* diagonal) {
     int seamNo = seam[0];
 
     for (int y = 1; y < height; y++) {
@@ -155,6 +471,14 @@ void build_seam(std::vector<int>& seam, std::vector<int>& seam_weights, const st
         int left = current_x > 0 ? energy[position - 1] : INT32_MAX;
         int middle = energy[position];
         int right = current_x < width - 1 ? energy[position + 1] : INT32_MAX;
+        if constexpr (diagonal_costs) {
+            if (current_x > 0) {
+                left += diagonal[position] & 0xFF;
+            }
+            if (current_x < width - 1) {
+                right += diagonal[position] >> 8;
+            }
+        }
 
         if (middle <= left && middle <= right) {
             seam[y] = current_x;
@@ -171,14 +495,40 @@ void build_seam(std::vector<int>& seam, std::vector<int>& seam_weights, const st
     }
 }
 
-void generate_seams(std::vector<std::vector<int>>& seams, std::vector<int>& seam_weights, std::vector<unsigned short>& energy, int width, int height, int raw_width, int seam_count) {
+//Picks the build_seam() for whether there is a diagonal map, so that the steps never check
+void build_seam(std::vector<int>& seam, std::vector<int>& seam_weights, const std::vector<unsigned short>& energy, int width, int height, const int raw_width,
+                const unsigned short* diagonal = nullptr) {
+    if (diagonal != nullptr) {
+        build_seam<true>(seam, seam_weights, energy, width, height, raw_width, diagonal);
+    }
+    else {
+        build_seam<false>(seam, seam_weights, energy, width, height, raw_width, diagonal);
+    }
+}
+
+//Lets another thread stop a carve; checked between seams and between the seams a search builds
+class CancellationToken {
+public:
+    void cancel() {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
 
-    //Init vector and first row
-    for (int x = 0; x < width; x++) {
-        seams[x] = std::vector<int>(height);
-        seams[x][0] = x;
-        seam_weights[x] = 0;
+    void reset() {
+        cancelled.store(false, std::memory_order_relaxed);
     }
+
+    bool is_cancelled() const {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> cancelled{false};
+};
+
+//Stops early if cancel is triggered, leaving seams and seam_weights unusable
+void generate_seams(std::vector<std::vector<int>>& seams, std::vector<int>& seam_weights, std::vector<unsigned short>& energy, int width, int height, int raw_width, int seam_count,
+                    const CancellationToken* cancel = nullptr, const unsigned short* diagonal = nullptr) {
+
     seam_weights.resize(width);
 
     int seam_spacing = width/seam_count;
@@ -186,9 +536,17 @@ void generate_seams(std::vector<std::vector<int>>& seams, std::vector<int>& seam
         seam_spacing = 1;
     }
 
+    //Only the seams actually built get storage, which they keep for the following searches,
+    //so once every starting column has been used no search allocates anymore
     for (int x = 0; x < width; x++) {
         if (x % seam_spacing == 0) {
-            build_seam(seams[x], seam_weights, energy, width, height, raw_width);
+            if (cancel != nullptr && cancel->is_cancelled()) {
+                return;
+            }
+            seams[x].resize(height);
+            seams[x][0] = x;
+            seam_weights[x] = 0;
+            build_seam(seams[x], seam_weights, energy, width, height, raw_width, diagonal);
         }
         else {
             seam_weights[x] = INT32_MAX;
@@ -196,27 +554,304 @@ void generate_seams(std::vector<std::vector<int>>& seams, std::vector<int>& seam
     }
 }
 
-//Removes seam with the least importance and recalculates energy map at affected pixels
-void remove_seam(unsigned int* img, std::vector<std::vector<int>>& seams, const std::vector<int>& seamWeights, std::vector<unsigned short>& energy, int& width, int& height, const int raw_width, unsigned char* grayscale) {
-    int index = std::distance(
-            std::begin(seamWeights), std::min_element(std::begin(seamWeights), std::end(seamWeights)));
+//Like build_seam, but never strays further than band pixels from the guide seam
+template <bool diagonal_costs>
+void build_seam_in_band(std::vector<int>& seam, std::vector<int>& seam_weights, const std::vector<unsigned short>& energy, int width, int height, const int raw_width,
+                        const std::vector<int>& guide, int band, const unsigned short* diagonal) {
+    int seamNo = seam[0];
+
+    for (int y = 1; y < height; y++) {
+        int current_x = seam[y-1];
+        int position = compute_offset(current_x, y, raw_width, 1);
+        int lowest = std::max(0, guide[y] - band);
+        int highest = std::min(width - 1, guide[y] + band);
+
+        int left = current_x > lowest ? energy[position - 1] : INT32_MAX;
+        int middle = current_x >= lowest && current_x <= highest ? energy[position] : INT32_MAX;
+        int right = current_x < highest ? energy[position + 1] : INT32_MAX;
+        if constexpr (diagonal_costs) {
+            if (current_x > lowest) {
+                left += diagonal[position] & 0xFF;
+            }
+            if (current_x < highest) {
+                right += diagonal[position] >> 8;
+            }
+        }
 
+        if (middle <= left && middle <= right) {
+            seam[y] = current_x;
+            seam_weights[seamNo] += middle;
+            continue;
+        }
+        if (left <= middle && left <= right) {
+            seam[y] = current_x-1;
+            seam_weights[seamNo] += left;
+            continue;
+        }
+        seam[y] = current_x+1;
+        seam_weights[seamNo] += right;
+    }
+}
+
+//Warm-started generate_seams: only builds the seams starting within band pixels of the guide seam, restricted to that band
+void generate_seams_in_band(std::vector<std::vector<int>>& seams, std::vector<int>& seam_weights, std::vector<unsigned short>& energy, int width, int height, int raw_width,
+                            const std::vector<int>& guide, int band, const unsigned short* diagonal = nullptr) {
+    seam_weights.assign(width, INT32_MAX);
+
+    int first = std::max(0, guide[0] - band);
+    int last = std::min(width - 1, guide[0] + band);
+    for (int x = first; x <= last; x++) {
+        seams[x].resize(height);
+        seams[x][0] = x;
+        seam_weights[x] = 0;
+        if (diagonal != nullptr) {
+            build_seam_in_band<true>(seams[x], seam_weights, energy, width, height, raw_width, guide, band, diagonal);
+        }
+        else {
+            build_seam_in_band<false>(seams[x], seam_weights, energy, width, height, raw_width, guide, band, diagonal);
+        }
+    }
+}
+
+//Shifts the pixels right of the seam one to the left, in img as well as in energy and diagonal, if given
+void shift_out_seam(unsigned int* img, const std::vector<int>& seam, std::vector<unsigned short>& energy, int width, int height, const int raw_width,
+                    unsigned short* diagonal = nullptr) {
     for (int y = 0; y < height; y++) {
-        for (int x = seams[index][y]; x < width - 1; x++) {
+        for (int x = seam[y]; x < width - 1; x++) {
             int position = compute_offset(x, y, raw_width, 1);
             img[position] = img[position+1];
             energy[position] = energy[position+1];
-            grayscale[position] = grayscale[position+1];
+        }
+        if (diagonal != nullptr) {
+            int position = compute_offset(seam[y], y, raw_width, 1);
+            std::copy(&diagonal[position + 1], &diagonal[position + width - seam[y]], &diagonal[position]);
         }
     }
+}
+
+//Removes the given seam and recalculates energy map at affected pixels
+void remove_seam_at(unsigned int* img, std::vector<int>& seam, std::vector<unsigned short>& energy, int& width, int height, const int raw_width,
+                    EnergyKind kind = EnergyKind::gradient, unsigned short* diagonal = nullptr) {
+    shift_out_seam(img, seam, energy, width, height, raw_width, diagonal);
     width--;
-    std::cout << "Removed seam no. " << index << ", new width: " << width << std::endl;
 
-    recalculate_energy_at_seam(energy, grayscale, width, height, raw_width, seams[index]);
+    recalculate_energy_at_seam(energy, img, width, height, raw_width, seam, kind, diagonal);
+}
+
+int lightest_seam(const std::vector<int>& seam_weights) {
+    return std::distance(std::begin(seam_weights), std::min_element(std::begin(seam_weights), std::end(seam_weights)));
+}
+
+//Removes seam with the least importance and recalculates energy map at affected pixels
+//Returns the index of the removed seam in seams
+int remove_seam(unsigned int* img, std::vector<std::vector<int>>& seams, const std::vector<int>& seamWeights, std::vector<unsigned short>& energy, int& width, int& height, const int raw_width,
+                EnergyKind kind = EnergyKind::gradient, unsigned short* diagonal = nullptr) {
+    int index = lightest_seam(seamWeights);
+
+    remove_seam_at(img, seams[index], energy, width, height, raw_width, kind, diagonal);
+    log_trace() << "Removed seam no. " << index << ", new width: " << width;
+    return index;
+}
+
+//Energy function of every workspace created from here on, set by --energy
+EnergyKind default_energy_kind = EnergyKind::gradient;
+
+//Buffers needed by carve_pixels()
+//Keeping one around per thread lets consecutive carves reuse the memory of the previous one
+struct CarveWorkspace {
+    std::vector<unsigned int> pixels;
+    std::vector<unsigned short> energy;
+    //What energy holds; prepare_carve() computes it and carve_prepared() keeps it up to date with the same function
+    EnergyKind energy_kind = default_energy_kind;
+    //Diagonal map of forward energy in the layout of energy, empty for the other energies
+    std::vector<unsigned short> diagonal;
+    std::vector<std::vector<int>> seams;
+    std::vector<int> seam_weights;
+
+    size_t capacity_bytes() const {
+        size_t seam_bytes = 0;
+        for (auto& seam : seams) {
+            seam_bytes += seam.capacity() * sizeof(int);
+        }
+        return pixels.capacity() * sizeof(unsigned int) + (energy.capacity() + diagonal.capacity()) * sizeof(unsigned short)
+            + seam_bytes + seam_weights.capacity() * sizeof(int);
+    }
+
+    //What the energy functions take for their diagonal argument
+    unsigned short* diagonal_map() {
+        return diagonal.empty() ? nullptr : diagonal.data();
+    }
+
+    //Gives the memory back if the last carve left more than max_bytes behind
+    void trim(size_t max_bytes) {
+        if (capacity_bytes() > max_bytes) {
+            EnergyKind kind = energy_kind;
+            *this = CarveWorkspace();
+            energy_kind = kind;
+        }
+    }
+};
+
+//Fills the energy map of the workspace for a freshly loaded image, with the workspace's energy_kind
+void prepare_carve(unsigned int* img, int width, int height, CarveWorkspace& workspace, CarveMetrics* metrics = nullptr) {
+    //Energy map must only be calculated once, and will only be partially recalculated (see remove_seam())
+    log_debug() << "Generating energy map";
+    PhaseTimer energy_timer(metrics, Phase::energy);
+    workspace.energy.resize(width*height);
+    workspace.diagonal.resize(energy_functions(workspace.energy_kind).diagonal_costs ? width*height : 0);
+    generate_energy_map(workspace.energy, img, width, height, width, workspace.energy_kind, workspace.diagonal_map());
+    log_debug() << "Energy map generated";
+}
+
+//Fills packed pixels and energy map of the workspace from a decoded RGBA image in a single pass down the rows
+//Same result as convert_to_int() followed by prepare_carve(), but each row is packed and its luma taken while it is
+//still in cache, instead of separate passes over the whole image. The packing of the rows is timed on its own and goes to
+//Phase::convert, the rest of the pass to Phase::energy together with its counters and allocations.
+void prepare_carve_rgba(const unsigned char* rgba, int width, int height, CarveWorkspace& workspace, CarveMetrics* metrics = nullptr) {
+    PhaseTimer energy_timer(metrics, Phase::energy);
+    workspace.pixels.resize(width*height);
+    workspace.energy.resize(width*height);
+    workspace.diagonal.resize(energy_functions(workspace.energy_kind).diagonal_costs ? width*height : 0);
+
+    log_debug() << "Converting image and generating energy map";
+    double convert_ms = 0;
+    generate_energy_rows(workspace.energy, workspace.pixels.data(), width, height, width, 0, height, workspace.energy_kind, rgba,
+                         workspace.diagonal_map(), metrics != nullptr ? &convert_ms : nullptr);
+    energy_timer.stop();
+    if (metrics != nullptr) {
+        metrics->add(Phase::energy, -convert_ms);
+        metrics->add(Phase::convert, convert_ms);
+    }
+    log_debug() << "Energy map generated";
+}
+
+//Called after every removed seam with the seam's x per row, in coordinates from before the removal
+using SeamRemovedCallback = std::function<void(const std::vector<int>& seam)>;
+
+//Called after every removed seam with the number of seams removed so far out of total and the time since the carve started
+using ProgressCallback = std::function<void(int removed, int total, double elapsed_ms)>;
+
+//Optional hooks into carve_prepared()
+struct CarveOptions {
+    SeamRemovedCallback on_removed;
+    ProgressCallback on_progress;
+    //Stops the carve at the next check, leaving img carved as far as it got
+    const CancellationToken* cancel = nullptr;
+    //Collects the time of seam search, compaction and recalculation, per phase and per seam
+    CarveMetrics* metrics = nullptr;
+
+    //Returns the seam removed by the same iteration in a related image of the same size (e.g. the previous video frame),
+    //or nullptr; given one, seams are only searched within guide_band pixels of it
+    std::function<const std::vector<int>*(int iteration)> guide;
+    int guide_band = 8;
+};
+
+//Removes n seams from an image prepared by prepare_carve() and updates width accordingly
+//May be called repeatedly to carve in steps, img keeps its row stride of raw_width throughout
+//Returns false if cancelled before all n seams were removed
+bool carve_prepared(unsigned int* img, int& width, int height, int raw_width, int n, int seam_count, CarveWorkspace& workspace,
+                    const CarveOptions& options = {}) {
+    std::vector<unsigned short>& energy = workspace.energy;
+    std::vector<std::vector<int>>& seams = workspace.seams;
+    std::vector<int>& seam_weights = workspace.seam_weights;
+    seams.resize(width);
+    seam_weights.assign(width, 0);
+
+    unsigned short* diagonal = workspace.diagonal_map();
+
+    log_debug() << "Commencing seam removal of " << n << " seams";
+
+    auto start_total = MetricsClock::now();
+
+    for (int i = 0; i < n; i++) {
+        if (options.cancel != nullptr && options.cancel->is_cancelled()) {
+            return false;
+        }
+        TraceSpan seam_span("seam");
+        PhaseMark start = mark_phase(options.metrics);
+        TraceSpan search_span("seam_search");
+        const std::vector<int>* guide = options.guide ? options.guide(i) : nullptr;
+        if (guide != nullptr) {
+            generate_seams_in_band(seams, seam_weights, energy, width, height, raw_width, *guide, options.guide_band, diagonal);
+        }
+        else {
+            generate_seams(seams, seam_weights, energy, width, height, raw_width, seam_count, options.cancel, diagonal);
+        }
+        if (options.cancel != nullptr && options.cancel->is_cancelled()) {
+            return false;
+        }
+        search_span.end();
+        PhaseMark built = mark_phase(options.metrics);
+
+        //remove_seam(), split up to time compaction and recalculation separately
+        TraceSpan compaction_span("compaction");
+        int removed = lightest_seam(seam_weights);
+        shift_out_seam(img, seams[removed], energy, width, height, raw_width, diagonal);
+        width--;
+        compaction_span.end();
+        PhaseMark compacted = mark_phase(options.metrics);
+        TraceSpan recalculation_span("recalculation");
+        recalculate_energy_at_seam(energy, img, width, height, raw_width, seams[removed], workspace.energy_kind, diagonal);
+        recalculation_span.end();
+        PhaseMark end = mark_phase(options.metrics);
+
+        log_trace() << "Removed seam no. " << removed << ", new width: " << width << "; search " << milliseconds_between(start, built)
+                    << "ms, compaction " << milliseconds_between(built, compacted) << "ms, recalculation " << milliseconds_between(compacted, end) << "ms";
+        if (options.metrics != nullptr) {
+            options.metrics->add(Phase::seam_search, start, built);
+            options.metrics->add(Phase::compaction, built, compacted);
+            options.metrics->add(Phase::recalculation, compacted, end);
+            options.metrics->add_seam(milliseconds_between(start, end), end.allocations - start.allocations);
+        }
+        if (options.on_removed) {
+            options.on_removed(seams[removed]);
+        }
+        if (options.on_progress) {
+            options.on_progress(i + 1, n, milliseconds_between(start_total, end.time));
+        }
+    }
+
+    log_debug() << "Total: " << milliseconds_between(start_total, MetricsClock::now()) << "ms";
+    return true;
+}
+
+//Removes n seams from the packed image in place and updates width accordingly
+//img keeps its row stride of the original width, postprocess() or compact_rows() compacts it afterwards
+//Returns false if cancelled before all n seams were removed
+bool carve_pixels(unsigned int* img, int& width, int height, int n, int seam_count, CarveWorkspace& workspace, const CarveOptions& options = {}) {
+    prepare_carve(img, width, height, workspace, options.metrics);
+    return carve_prepared(img, width, height, width, n, seam_count, workspace, options);
+}
+
+void carve_pixels(unsigned int* img, int& width, int height, int n, int seam_count) {
+    CarveWorkspace workspace;
+    carve_pixels(img, width, height, n, seam_count, workspace);
+}
+
+//Called whenever carve_to_targets() reaches one of the requested widths
+//img still has a row stride of raw_width and is only valid until the callback returns
+using TargetReachedCallback = std::function<void(const unsigned int* img, int width, int height, int raw_width)>;
+
+//Carves down through every width in targets within a single run of the removal loop
+//Targets may come in any order; on_target sees them from the widest to the narrowest
+void carve_to_targets(unsigned int* img, int& width, int height, std::vector<int> targets, int seam_count, CarveWorkspace& workspace,
+                      const TargetReachedCallback& on_target) {
+    for (int& target : targets) {
+        target = std::clamp(target, 1, width);
+    }
+    std::sort(targets.begin(), targets.end(), std::greater<>());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+    int raw_width = width;
+    prepare_carve(img, width, height, workspace);
+    for (int target : targets) {
+        carve_prepared(img, width, height, raw_width, width - target, seam_count, workspace);
+        on_target(img, width, height, raw_width);
+    }
 }
 
 unsigned int* postprocess (unsigned int* img, int width, int height, int raw_width) {
-    auto* new_img = (unsigned int*) malloc(width*height*sizeof(int));
+    auto* new_img = (unsigned int*) tracked_malloc(width*height*sizeof(int));
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
             int position_old = compute_offset(x, y, raw_width, 1);
@@ -225,8 +860,24 @@ unsigned int* postprocess (unsigned int* img, int width, int height, int raw_wid
         }
     }
 
-    free(img);
+    tracked_free(img);
+    return new_img;
+}
+
+//Same as postprocess, but leaves img untouched and returns a compacted copy
+unsigned int* compacted_copy(const unsigned int* img, int width, int height, int raw_width) {
+    auto* new_img = (unsigned int*) tracked_malloc(width*height*sizeof(int));
+    for (int y = 0; y < height; y++) {
+        memcpy(new_img + compute_offset(0, y, width, 1), img + compute_offset(0, y, raw_width, 1), width*sizeof(unsigned int));
+    }
     return new_img;
 }
 
+//Same as postprocess, but moves the rows together inside the existing buffer
+void compact_rows(unsigned int* img, int width, int height, int raw_width) {
+    for (int y = 1; y < height; y++) {
+        memmove(img + compute_offset(0, y, width, 1), img + compute_offset(0, y, raw_width, 1), width*sizeof(unsigned int));
+    }
+}
+
 #endif //SEAMCARVING_MAIN_H
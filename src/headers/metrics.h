@@ -0,0 +1,275 @@
+#ifndef SEAMCARVING_METRICS_H
+#define SEAMCARVING_METRICS_H
+
+#include "allocations.h"
+#include "perf_counters.h"
+#include "trace.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Steps of a carve whose time is reported separately
+enum class Phase {
+    decode,
+    convert,
+    energy,
+    seam_search,
+    compaction,
+    recalculation,
+    encode
+};
+
+const int phase_count = 7;
+
+const char* phase_name(Phase phase) {
+    const char* names[phase_count] = {"decode", "convert", "energy", "seam_search", "compaction", "recalculation", "encode"};
+    return names[static_cast<int>(phase)];
+}
+
+using MetricsClock = std::chrono::steady_clock;
+
+double milliseconds_between(MetricsClock::time_point start, MetricsClock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+//A point in time together with the hardware counters and allocation totals at that point, if any are collected
+struct PhaseMark {
+    MetricsClock::time_point time;
+    CounterReading counters{};
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+    //Peak live bytes since the previous mark
+    int64_t peak_live = 0;
+};
+
+double milliseconds_between(const PhaseMark& start, const PhaseMark& end) {
+    return milliseconds_between(start.time, end.time);
+}
+
+//Time spent per phase and per seam over one job, written out as a JSON document
+class CarveMetrics {
+public:
+    void add(Phase phase, double ms) {
+        phase_ms[static_cast<int>(phase)] += ms;
+    }
+
+    //Adds time and counter deltas between two marks of mark()
+    void add(Phase phase, const PhaseMark& start, const PhaseMark& end) {
+        add(phase, milliseconds_between(start, end));
+        for (int i = 0; i < counter_count; i++) {
+            phase_counters[static_cast<int>(phase)][i] += end.counters[i] - start.counters[i];
+        }
+        PhaseAllocations& allocations = phase_allocations[static_cast<int>(phase)];
+        allocations.count += end.allocations - start.allocations;
+        allocations.bytes += end.allocated_bytes - start.allocated_bytes;
+        allocations.peak_live = std::max(allocations.peak_live, end.peak_live);
+    }
+
+    //Samples counters along with the time of each mark from now on; they must belong to the thread doing the work
+    void use_counters(const PerfCounters* perf_counters) {
+        counters = perf_counters;
+    }
+
+    PhaseMark mark() const {
+        PhaseMark mark{MetricsClock::now(), counters != nullptr ? counters->read() : CounterReading{}};
+        if (allocations_tracked()) {
+            mark.allocations = allocation_counters.count.load(std::memory_order_relaxed);
+            mark.allocated_bytes = allocation_counters.bytes.load(std::memory_order_relaxed);
+            mark.peak_live = take_window_peak();
+        }
+        return mark;
+    }
+
+    //Search, compaction and recalculation of one removed seam, and the allocations they made
+    void add_seam(double ms, uint64_t allocations = 0) {
+        seam_ms.push_back(ms);
+        seam_allocations += allocations;
+        max_seam_allocations = std::max(max_seam_allocations, allocations);
+    }
+
+    //Describes the job at the top of the document
+    void describe(const std::string& key, const std::string& value) {
+        fields.emplace_back(key, quote(value));
+    }
+
+    void describe(const std::string& key, double value) {
+        fields.emplace_back(key, number(value));
+    }
+
+    std::string to_json() const {
+        std::string json = "{\n";
+        for (auto& [key, value] : fields) {
+            json += "  " + quote(key) + ": " + value + ",\n";
+        }
+
+        double total = 0;
+        json += "  \"phases_ms\": {";
+        for (int i = 0; i < phase_count; i++) {
+            json += std::string(i > 0 ? ", " : "") + quote(phase_name(static_cast<Phase>(i))) + ": " + number(phase_ms[i]);
+            total += phase_ms[i];
+        }
+        json += "},\n  \"total_ms\": " + number(total) + ",\n";
+        if (counters != nullptr) {
+            json += counters_json();
+        }
+        if (allocations_tracked()) {
+            json += allocations_json();
+        }
+
+        std::vector<double> sorted = seam_ms;
+        std::sort(sorted.begin(), sorted.end());
+        double seam_total = 0;
+        for (double ms : sorted) {
+            seam_total += ms;
+        }
+        json += "  \"seams\": {\"count\": " + std::to_string(sorted.size())
+            + ", \"p50_ms\": " + number(percentile(sorted, 50))
+            + ", \"p95_ms\": " + number(percentile(sorted, 95))
+            + ", \"max_ms\": " + number(sorted.empty() ? 0 : sorted.back())
+            + ", \"per_second\": " + number(seam_total > 0 ? sorted.size() * 1000 / seam_total : 0);
+        if (allocations_tracked()) {
+            json += ", \"allocations\": " + std::to_string(seam_allocations) + ", \"max_allocations_per_seam\": " + std::to_string(max_seam_allocations);
+        }
+        json += "}\n}\n";
+        return json;
+    }
+
+    bool write_json(const std::string& path) const {
+        FILE* file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            return false;
+        }
+        std::string json = to_json();
+        bool ok = fwrite(json.data(), 1, json.size(), file) == json.size();
+        return fclose(file) == 0 && ok;
+    }
+
+private:
+    struct PhaseAllocations {
+        uint64_t count = 0;
+        uint64_t bytes = 0;
+        int64_t peak_live = 0;
+    };
+
+    //Allocations of the whole process since tracking started, then per phase
+    std::string allocations_json() const {
+        std::string json = "  \"allocations\": {\"count\": " + std::to_string(allocation_counters.count.load())
+            + ", \"bytes\": " + std::to_string(allocation_counters.bytes.load())
+            + ", \"peak_live_bytes\": " + std::to_string(allocation_counters.peak.load()) + ", \"phases\": {";
+        for (int i = 0; i < phase_count; i++) {
+            const PhaseAllocations& allocations = phase_allocations[i];
+            json += std::string(i > 0 ? "," : "") + "\n    " + quote(phase_name(static_cast<Phase>(i))) + ": {\"count\": " + std::to_string(allocations.count)
+                + ", \"bytes\": " + std::to_string(allocations.bytes) + ", \"peak_live_bytes\": " + std::to_string(allocations.peak_live) + "}";
+        }
+        return json + "\n  }},\n";
+    }
+
+    //Per phase totals of the available counters, plus why the others are missing
+    std::string counters_json() const {
+        std::string json = "  \"counters\": {\"unavailable\": " + quote(counters->unavailable_reason()) + ", \"phases\": {";
+        for (int i = 0; i < phase_count; i++) {
+            json += std::string(i > 0 ? "," : "") + "\n    " + quote(phase_name(static_cast<Phase>(i))) + ": {";
+            bool first = true;
+            for (int c = 0; c < counter_count; c++) {
+                if (counters->has(static_cast<Counter>(c))) {
+                    json += std::string(first ? "" : ", ") + quote(counter_name(static_cast<Counter>(c))) + ": " + whole_number(phase_counters[i][c]);
+                    first = false;
+                }
+            }
+            json += "}";
+        }
+        return json + "\n  }},\n";
+    }
+
+    //Nearest rank of an ascending list
+    static double percentile(const std::vector<double>& sorted, int percent) {
+        if (sorted.empty()) {
+            return 0;
+        }
+        size_t rank = (sorted.size() * percent + 99) / 100;
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    }
+
+    static std::string number(double value) {
+        char text[32];
+        snprintf(text, sizeof(text), "%.6g", value);
+        return text;
+    }
+
+    static std::string whole_number(double value) {
+        char text[32];
+        snprintf(text, sizeof(text), "%.0f", value);
+        return text;
+    }
+
+    static std::string quote(const std::string& text) {
+        std::string quoted = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+                quoted += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                quoted += escaped;
+            }
+            else {
+                quoted += c;
+            }
+        }
+        return quoted + "\"";
+    }
+
+    std::array<double, phase_count> phase_ms{};
+    std::array<CounterReading, phase_count> phase_counters{};
+    std::array<PhaseAllocations, phase_count> phase_allocations{};
+    uint64_t seam_allocations = 0;
+    uint64_t max_seam_allocations = 0;
+    const PerfCounters* counters = nullptr;
+    std::vector<double> seam_ms;
+    std::vector<std::pair<std::string, std::string>> fields;
+};
+
+//Adds the time from construction to stop() (or destruction) to a phase; does nothing without a collector
+//The phase is traced as a span either way.
+class PhaseTimer {
+public:
+    PhaseTimer(CarveMetrics* metrics, Phase phase) : metrics(metrics), phase(phase), span(phase_name(phase)) {
+        if (metrics != nullptr) {
+            start = metrics->mark();
+        }
+    }
+
+    ~PhaseTimer() {
+        stop();
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    void stop() {
+        span.end();
+        if (metrics != nullptr) {
+            metrics->add(phase, start, metrics->mark());
+            metrics = nullptr;
+        }
+    }
+
+private:
+    CarveMetrics* metrics;
+    Phase phase;
+    TraceSpan span;
+    PhaseMark start;
+};
+
+//Mark of metrics, or just the time without a collector
+PhaseMark mark_phase(const CarveMetrics* metrics) {
+    return metrics != nullptr ? metrics->mark() : PhaseMark{MetricsClock::now()};
+}
+
+#endif //SEAMCARVING_METRICS_H
@@ -0,0 +1,132 @@
+#ifndef SEAMCARVING_PERF_COUNTERS_H
+#define SEAMCARVING_PERF_COUNTERS_H
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//Hardware events counted around each phase
+enum class Counter {
+    cycles,
+    instructions,
+    l1_misses,
+    llc_misses,
+    branch_misses
+};
+
+const int counter_count = 5;
+
+const char* counter_name(Counter counter) {
+    const char* names[counter_count] = {"cycles", "instructions", "l1d_read_misses", "llc_misses", "branch_misses"};
+    return names[static_cast<int>(counter)];
+}
+
+//Totals of every counter since they were opened, zero for those that are not available
+using CounterReading = std::array<double, counter_count>;
+
+//perf_event_open() counters of the calling thread, user space only
+//All counters form one group, so a single read() samples them together. Counters the kernel refuses, as it does in
+//most containers and with perf_event_paranoid above 2, stay unavailable and read as zero; nothing else changes.
+class PerfCounters {
+public:
+    PerfCounters() {
+        const uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const std::pair<uint32_t, uint64_t> events[counter_count] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_read_miss},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        for (int i = 0; i < counter_count; i++) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = events[i].first;
+            attr.config = events[i].second;
+            attr.disabled = leader < 0 ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd < 0) {
+                if (reason.empty()) {
+                    reason = std::string(counter_name(static_cast<Counter>(i))) + ": " + strerror(errno);
+                }
+                continue;
+            }
+            if (leader < 0) {
+                leader = fd;
+            }
+            fds[i] = fd;
+            slots[i] = opened++;
+        }
+        if (leader >= 0) {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    ~PerfCounters() {
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const {
+        return leader >= 0;
+    }
+
+    bool has(Counter counter) const {
+        return fds[static_cast<int>(counter)] >= 0;
+    }
+
+    //Why the first unavailable counter could not be opened, empty if all were
+    const std::string& unavailable_reason() const {
+        return reason;
+    }
+
+    //Scaled up by the share of time the group was actually on the PMU, in case the kernel multiplexed it
+    CounterReading read() const {
+        CounterReading reading{};
+        if (leader < 0) {
+            return reading;
+        }
+        uint64_t buffer[3 + counter_count];
+        if (::read(leader, buffer, sizeof(buffer)) < static_cast<ssize_t>((3 + opened) * sizeof(uint64_t))) {
+            return reading;
+        }
+        uint64_t enabled = buffer[1];
+        uint64_t running = buffer[2];
+        if (running == 0) {
+            return reading;
+        }
+        double scale = static_cast<double>(enabled) / running;
+        for (int i = 0; i < counter_count; i++) {
+            if (slots[i] >= 0) {
+                reading[i] = buffer[3 + slots[i]] * scale;
+            }
+        }
+        return reading;
+    }
+
+private:
+    std::array<int, counter_count> fds = {-1, -1, -1, -1, -1};
+    //Position of each counter's value in a group read
+    std::array<int, counter_count> slots = {-1, -1, -1, -1, -1};
+    int leader = -1;
+    int opened = 0;
+    std::string reason;
+};
+
+#endif //SEAMCARVING_PERF_COUNTERS_H
@@ -0,0 +1,124 @@
+#ifndef SEAMCARVING_SCHEDULER_H
+#define SEAMCARVING_SCHEDULER_H
+
+#include "main.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <unistd.h>
+
+//Predicted resource use of one carve
+struct JobCost {
+    size_t peak_bytes = 0;
+    double cpu_ms = 0;
+};
+
+//Predicts the peak memory and CPU time of carving remove pixels off a width x height image
+//Memory per pixel while carving: 4 (packed pixels) + 2 (energy) + 4 (one int per pixel for the seams), 2 more for the
+//diagonal map of energies with diagonal costs, followed by up to 12 more while encoding (unpacked RGBA, PNG filter
+//buffer and compressed output).
+//The CPU constants were measured on a desktop core and only need to be right relative to each other.
+JobCost estimate_job_cost(int width, int height, int remove, int seam_count, EnergyKind kind, size_t input_bytes = 0) {
+    JobCost cost;
+    auto pixels = static_cast<double>(width) * height;
+    size_t seam_overhead = static_cast<size_t>(width) * (sizeof(std::vector<int>) + sizeof(int));
+    int carve_bytes = energy_functions(kind).diagonal_costs ? 12 : 10;
+    cost.peak_bytes = static_cast<size_t>(pixels * (carve_bytes + 12)) + seam_overhead + input_bytes;
+
+    remove = std::clamp(remove, 0, std::max(0, width - 1));
+    double average_width = width - remove / 2.0;
+    double built_seams = std::min<double>(seam_count, average_width);
+
+    double front_ns = 340 * pixels;
+    double seam_ns = remove * height * (0.45 * average_width + 4 * built_seams);
+    cost.cpu_ms = (front_ns + seam_ns) / 1e6;
+    return cost;
+}
+
+//Three quarters of the physical memory, the default budget for batch and daemon mode
+size_t default_memory_budget() {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) {
+        return SIZE_MAX;
+    }
+    return static_cast<size_t>(pages) * page_size / 4 * 3;
+}
+
+//Admits jobs only while their predicted peak memory fits into the budget
+//Waiting jobs start by descending priority, then shortest predicted CPU time first, then in arrival order.
+//Jobs larger than the whole budget are rejected up front instead of waiting forever.
+class JobScheduler {
+public:
+    JobScheduler(size_t memory_budget, int max_running) : memory_budget(memory_budget), max_running(std::max(1, max_running)) {}
+
+    bool fits_budget(const JobCost& cost) const {
+        return cost.peak_bytes <= memory_budget;
+    }
+
+    //Blocks until the job may start; returns false if it can never fit
+    bool acquire(const JobCost& cost, int priority = 0) {
+        if (!fits_budget(cost)) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        auto ticket = waiting.insert({priority, cost.cpu_ms, next_sequence++, cost.peak_bytes}).first;
+        changed.wait(lock, [&] {
+            return ticket == waiting.begin() && running < max_running && used_bytes + cost.peak_bytes <= memory_budget;
+        });
+        waiting.erase(ticket);
+        used_bytes += cost.peak_bytes;
+        running++;
+
+        //The next in line may fit as well
+        changed.notify_all();
+        return true;
+    }
+
+    void release(const JobCost& cost) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            used_bytes -= cost.peak_bytes;
+            running--;
+        }
+        changed.notify_all();
+    }
+
+    size_t budget() const {
+        return memory_budget;
+    }
+
+private:
+    struct Waiting {
+        int priority;
+        double cpu_ms;
+        unsigned long sequence;
+        size_t peak_bytes;
+
+        bool operator<(const Waiting& other) const {
+            if (priority != other.priority) {
+                return priority > other.priority;
+            }
+            if (cpu_ms != other.cpu_ms) {
+                return cpu_ms < other.cpu_ms;
+            }
+            return sequence < other.sequence;
+        }
+    };
+
+    size_t memory_budget;
+    int max_running;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::set<Waiting> waiting;
+    size_t used_bytes = 0;
+    int running = 0;
+    unsigned long next_sequence = 0;
+};
+
+#endif //SEAMCARVING_SCHEDULER_H
@@ -0,0 +1,113 @@
+#ifndef SEAMCARVING_SEAM_INDEX_H
+#define SEAMCARVING_SEAM_INDEX_H
+
+#include "main.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+//Order in which carving removes the pixels of an image, for retargeting to any width without carving again
+//order[y*width + x] is the iteration that removes pixel (x, y); the pixel left over in each row holds width-1.
+//Keeping the pixels with order >= width - target therefore leaves exactly target pixels in every row.
+struct SeamOrderIndex {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned short> order;
+};
+
+//Widest image whose removal iterations still fit into the uint16 index
+const int max_index_width = UINT16_MAX + 1;
+
+//Carves img all the way down to a width of 1 and records which iteration removed every pixel
+//img is consumed in the process
+bool build_seam_order_index(unsigned int* img, int width, int height, int seam_count, SeamOrderIndex& index, CarveWorkspace& workspace) {
+    if (width > max_index_width) {
+        return false;
+    }
+
+    int raw_width = width;
+    index.width = width;
+    index.height = height;
+    index.order.assign(width*height, 0);
+
+    //Original x of the pixel currently at each position, shifted along with the image
+    std::vector<unsigned short> origin(width*height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            origin[compute_offset(x, y, raw_width, 1)] = x;
+        }
+    }
+
+    int iteration = 0;
+    int current_width = width;
+    prepare_carve(img, width, height, workspace);
+    CarveOptions options;
+    options.on_removed = [&](const std::vector<int>& seam) {
+        for (int y = 0; y < height; y++) {
+            int position = compute_offset(seam[y], y, raw_width, 1);
+            index.order[compute_offset(origin[position], y, raw_width, 1)] = iteration;
+            memmove(&origin[position], &origin[position + 1], (current_width - 1 - seam[y]) * sizeof(unsigned short));
+        }
+        iteration++;
+        current_width--;
+    };
+    carve_prepared(img, width, height, raw_width, width - 1, seam_count, workspace, options);
+
+    for (int y = 0; y < height; y++) {
+        index.order[compute_offset(origin[compute_offset(0, y, raw_width, 1)], y, raw_width, 1)] = raw_width - 1;
+    }
+    return true;
+}
+
+//File layout: "SCI1", width and height as uint32, then width*height uint16 removal iterations
+bool save_seam_order_index(const std::string& path, const SeamOrderIndex& index) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    uint32_t header[3] = {0x31494353, static_cast<uint32_t>(index.width), static_cast<uint32_t>(index.height)};
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1
+        && fwrite(index.order.data(), sizeof(unsigned short), index.order.size(), file) == index.order.size();
+    return fclose(file) == 0 && ok;
+}
+
+bool load_seam_order_index(const std::string& path, SeamOrderIndex& index) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    uint32_t header[3];
+    bool ok = fread(header, sizeof(header), 1, file) == 1 && header[0] == 0x31494353
+        && header[1] > 0 && header[1] <= static_cast<uint32_t>(max_index_width) && header[2] > 0;
+    if (ok) {
+        index.width = static_cast<int>(header[1]);
+        index.height = static_cast<int>(header[2]);
+        index.order.resize(static_cast<size_t>(index.width) * index.height);
+        ok = fread(index.order.data(), sizeof(unsigned short), index.order.size(), file) == index.order.size();
+    }
+    fclose(file);
+    return ok;
+}
+
+//Single filter pass over an RGBA image keeping the target_width pixels per row that carving would keep
+//Returns a newly allocated RGBA array of target_width x height
+unsigned char* retarget_with_index(const unsigned char* img, const SeamOrderIndex& index, int target_width) {
+    int threshold = index.width - target_width;
+    auto* ret = (unsigned char*) tracked_malloc(target_width*index.height*4);
+
+    for (int y = 0; y < index.height; y++) {
+        const unsigned short* order = &index.order[compute_offset(0, y, index.width, 1)];
+        const unsigned char* source = img + compute_offset(0, y, index.width, 4);
+        unsigned char* target = ret + compute_offset(0, y, target_width, 4);
+        for (int x = 0; x < index.width; x++) {
+            if (order[x] >= threshold) {
+                memcpy(target, source + x*4, 4);
+                target += 4;
+            }
+        }
+    }
+
+    return ret;
+}
+
+#endif //SEAMCARVING_SEAM_INDEX_H
@@ -0,0 +1,257 @@
+#ifndef SEAMCARVING_SEQUENCE_H
+#define SEAMCARVING_SEQUENCE_H
+
+#include "main.h"
+#include "thread_pool.h"
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+struct SequenceOptions {
+    int remove = 0;
+    int seam_count = 100;
+    //Frames carved at once; each one follows the seams of the frame before it
+    int threads = 1;
+    //How far a seam may move away from the previous frame's seam, a negative band carves every frame independently
+    int band = 8;
+    //Frame size of raw RGBA streams, image files bring their own
+    int width = 0;
+    int height = 0;
+};
+
+//Seams one frame removed so far, published one by one for the next frame to follow
+//A deque, so the seams already handed out stay where they are while more arrive.
+struct FrameSeams {
+    std::mutex mutex;
+    std::condition_variable published;
+    std::deque<std::vector<int>> seams;
+    int width = 0;
+    int height = 0;
+    bool done = false;
+};
+
+//One frame on its way through the pipeline
+struct SequenceFrame {
+    std::string input;
+    std::string output;
+    //Raw RGBA input of stream frames, replaced by the carved RGBA output
+    std::vector<unsigned char> rgba;
+    int width = 0;
+    int height = 0;
+    std::string error;
+    std::shared_ptr<FrameSeams> seams = std::make_shared<FrameSeams>();
+    std::shared_ptr<FrameSeams> previous;
+    std::promise<void> finished;
+};
+
+//Carves one frame, taking iteration i's seam from within options.band pixels of the seam the previous frame removed at i
+//Runs as a wavefront: a frame only waits for the previous one to publish the seam it needs next, not for it to finish.
+void carve_frame(SequenceFrame& frame, const SequenceOptions& options, CarveWorkspace& workspace) {
+    TraceSpan frame_span("frame");
+    FrameSeams& own = *frame.seams;
+    auto publish_done = [&] {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.done = true;
+        own.published.notify_all();
+    };
+
+    int width = frame.width;
+    int height = frame.height;
+    if (!frame.input.empty()) {
+        int channels;
+        TraceSpan decode_span("decode");
+        unsigned char* raw_img = stbi_load(frame.input.c_str(), &width, &height, &channels, 4);
+        if (raw_img == nullptr) {
+            frame.error = stbi_failure_reason();
+            publish_done();
+            return;
+        }
+        decode_span.end();
+        TraceSpan convert_span("convert");
+        prepare_carve_rgba(raw_img, width, height, workspace);
+        stbi_image_free(raw_img);
+    }
+    else {
+        TraceSpan convert_span("convert");
+        prepare_carve_rgba(frame.rgba.data(), width, height, workspace);
+    }
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.width = width;
+        own.height = height;
+    }
+
+    CarveOptions carve_options;
+    carve_options.on_removed = [&](const std::vector<int>& seam) {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.seams.push_back(seam);
+        own.published.notify_all();
+    };
+    if (frame.previous != nullptr && options.band >= 0) {
+        FrameSeams& previous = *frame.previous;
+        carve_options.guide_band = options.band;
+        carve_options.guide = [&, width, height](int iteration) -> const std::vector<int>* {
+            TraceSpan wait_span("wait_for_previous_frame");
+            std::unique_lock<std::mutex> lock(previous.mutex);
+            previous.published.wait(lock, [&] { return previous.done || static_cast<int>(previous.seams.size()) > iteration; });
+            wait_span.end();
+            if (previous.width != width || previous.height != height || static_cast<int>(previous.seams.size()) <= iteration) {
+                return nullptr;
+            }
+            return &previous.seams[iteration];
+        };
+    }
+
+    unsigned int* img = workspace.pixels.data();
+    int raw_width = width;
+    carve_prepared(img, width, height, raw_width, std::min(options.remove, width - 1), options.seam_count, workspace, carve_options);
+    publish_done();
+    frame.previous.reset();
+
+    TraceSpan encode_span("encode");
+    compact_rows(img, width, height, raw_width);
+    unsigned char* raw_img = convert_to_char(img, width, height, 4);
+    if (!frame.output.empty()) {
+        if (!stbi_write_png(frame.output.c_str(), width, height, 4, raw_img, width * 4)) {
+            frame.error = "cannot write " + frame.output;
+        }
+    }
+    else {
+        frame.rgba.assign(raw_img, raw_img + static_cast<size_t>(width) * height * 4);
+    }
+    tracked_free(raw_img);
+    frame.width = width;
+    frame.height = height;
+}
+
+//Frames of a sequence in order, either image files or raw RGBA frames of a fixed size read from a stream
+class FrameSource {
+public:
+    static std::unique_ptr<FrameSource> files(std::vector<std::string> paths) {
+        auto source = std::unique_ptr<FrameSource>(new FrameSource());
+        source->paths = std::move(paths);
+        return source;
+    }
+
+    static std::unique_ptr<FrameSource> stream(FILE* file, int width, int height) {
+        auto source = std::unique_ptr<FrameSource>(new FrameSource());
+        source->file = file;
+        source->width = width;
+        source->height = height;
+        return source;
+    }
+
+    //Fills in the next frame's input; returns false at the end of the sequence
+    bool next(SequenceFrame& frame) {
+        if (file == nullptr) {
+            if (index >= paths.size()) {
+                return false;
+            }
+            frame.input = paths[index++];
+            return true;
+        }
+
+        size_t size = static_cast<size_t>(width) * height * 4;
+        frame.rgba.resize(size);
+        size_t read = fread(frame.rgba.data(), 1, size, file);
+        if (read != size) {
+            if (read != 0) {
+                log_error() << "Error: stream ends within a frame, dropping its " << read << " bytes";
+            }
+            return false;
+        }
+        frame.width = width;
+        frame.height = height;
+        return true;
+    }
+
+private:
+    FrameSource() = default;
+
+    std::vector<std::string> paths;
+    size_t index = 0;
+    FILE* file = nullptr;
+    int width = 0;
+    int height = 0;
+};
+
+//Image files of a frame directory in name order
+std::vector<std::string> list_frames(const std::string& directory) {
+    std::vector<std::string> frames;
+    for (auto& entry : std::filesystem::directory_iterator(directory)) {
+        std::string extension = entry.path().extension().string();
+        if (entry.is_regular_file() && (extension == ".png" || extension == ".jpg" || extension == ".JPG")) {
+            frames.push_back(entry.path().string());
+        }
+    }
+    std::sort(frames.begin(), frames.end());
+    return frames;
+}
+
+//Carves every frame of source, with up to options.threads + 1 frames in flight
+//Frames from files are written to <output dir>/<input name>.png, raw frames in order to output as carved RGBA.
+int run_sequence(FrameSource& source, const std::string& out_dir, FILE* output, const SequenceOptions& options) {
+    ThreadPool workers(options.threads);
+    std::deque<std::unique_ptr<SequenceFrame>> in_flight;
+    std::shared_ptr<FrameSeams> previous;
+    int frames = 0;
+    int failures = 0;
+    auto start = MetricsClock::now();
+
+    auto retire_oldest = [&] {
+        SequenceFrame& frame = *in_flight.front();
+        frame.finished.get_future().wait();
+        if (!frame.error.empty()) {
+            log_error() << "Error: frame " << frames << ": " << frame.error;
+            failures++;
+        }
+        else if (output != nullptr && fwrite(frame.rgba.data(), 1, frame.rgba.size(), output) != frame.rgba.size()) {
+            log_error() << "Error: frame " << frames << ": cannot write to the output stream";
+            failures++;
+        }
+        frames++;
+        in_flight.pop_front();
+    };
+
+    while (true) {
+        auto frame = std::make_unique<SequenceFrame>();
+        if (!source.next(*frame)) {
+            break;
+        }
+        if (!frame->input.empty()) {
+            frame->output = (std::filesystem::path(out_dir) / std::filesystem::path(frame->input).stem()).string() + ".png";
+        }
+        frame->previous = previous;
+        previous = frame->seams;
+
+        if (static_cast<int>(in_flight.size()) > options.threads) {
+            retire_oldest();
+        }
+        SequenceFrame* job = frame.get();
+        in_flight.push_back(std::move(frame));
+        //FIFO order of the pool guarantees the previous frame is running before this one waits on its seams
+        workers.submit([job, &options] {
+            thread_local CarveWorkspace workspace;
+            carve_frame(*job, options, workspace);
+            job->finished.set_value();
+        });
+    }
+    while (!in_flight.empty()) {
+        retire_oldest();
+    }
+    if (output != nullptr) {
+        fflush(output);
+    }
+
+    double seconds = milliseconds_between(start, MetricsClock::now()) / 1000;
+    log_info() << "Sequence done: " << frames - failures << " frames carved, " << failures << " failed, "
+               << (seconds > 0 ? frames / seconds : 0) << " frames/s";
+    return failures == 0 ? 0 : 1;
+}
+
+#endif //SEAMCARVING_SEQUENCE_H
@@ -0,0 +1,157 @@
+#ifndef SEAMCARVING_SHM_FRAMES_H
+#define SEAMCARVING_SHM_FRAMES_H
+
+#include "main.h"
+#include <bit>
+#include <map>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Raw RGBA frame living in shared memory, either a POSIX shm object or a file descriptor (memfd) sent by the client
+struct SharedFrame {
+    unsigned char* mapping = nullptr;
+    size_t mapped_size = 0;
+    size_t offset = 0;
+
+    SharedFrame() = default;
+    SharedFrame(const SharedFrame&) = delete;
+    SharedFrame& operator=(const SharedFrame&) = delete;
+
+    ~SharedFrame() {
+        if (mapping != nullptr) {
+            munmap(mapping, mapped_size);
+        }
+    }
+
+    unsigned char* pixels() const {
+        return mapping + offset;
+    }
+
+    //Maps the whole object behind fd and checks that it holds required bytes after offset
+    //Returns an error message, or an empty string on success
+    std::string map(int fd, size_t frame_offset, size_t required) {
+        struct stat info{};
+        if (fstat(fd, &info) != 0) {
+            return "cannot stat segment";
+        }
+        if (frame_offset % sizeof(unsigned int) != 0 || static_cast<size_t>(info.st_size) < frame_offset + required) {
+            return "segment too small or misaligned";
+        }
+        void* memory = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (memory == MAP_FAILED) {
+            return "cannot map segment";
+        }
+        mapping = static_cast<unsigned char*>(memory);
+        mapped_size = info.st_size;
+        offset = frame_offset;
+        return "";
+    }
+
+    std::string map_named(const std::string& name, size_t frame_offset, size_t required) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            return "cannot open shm " + name;
+        }
+        std::string error = map(fd, frame_offset, required);
+        close(fd);
+        return error;
+    }
+};
+
+//Packed pixels put red in the lowest byte, which is exactly the RGBA byte order on little-endian machines
+//On big-endian machines the frame is swapped in place on the way in and out instead
+void swap_frame_to_packed(unsigned char* frame, size_t pixel_count) {
+    if constexpr (std::endian::native == std::endian::big) {
+        auto* pixels = reinterpret_cast<unsigned int*>(frame);
+        for (size_t i = 0; i < pixel_count; i++) {
+            pixels[i] = __builtin_bswap32(pixels[i]);
+        }
+    }
+}
+
+//Maps the frame named by the <prefix>_shm or <prefix>_fd field, <prefix>_fd indexes the descriptors sent with the request
+std::string map_shared_frame(SharedFrame& frame, const std::map<std::string, std::string>& fields, const std::string& prefix,
+                             const std::vector<int>& fds, size_t required) {
+    size_t offset = 0;
+    auto offset_field = fields.find(prefix + "_offset");
+    if (offset_field != fields.end()) {
+        offset = std::stoul(offset_field->second);
+    }
+
+    auto name = fields.find(prefix + "_shm");
+    if (name != fields.end()) {
+        return frame.map_named(name->second, offset, required);
+    }
+    auto fd_index = fields.find(prefix + "_fd");
+    if (fd_index != fields.end()) {
+        size_t index = std::stoul(fd_index->second);
+        if (index >= fds.size()) {
+            return "no file descriptor " + fd_index->second + " was passed";
+        }
+        return frame.map(fds[index], offset, required);
+    }
+    return "missing " + prefix + "_shm or " + prefix + "_fd";
+}
+
+//Carves the frame directly inside the shared mapping; only energy and seams live in the workspace
+//Without an output segment the result is compacted to the start of the input frame (stride = new width).
+//With one, the input frame serves as scratch space and the compacted rows are written to the output frame.
+//Returns an error message, or an empty string on success
+std::string carve_shared_frame(const std::map<std::string, std::string>& fields, const std::vector<int>& fds, CarveWorkspace& workspace,
+                               int& width, int& height, const CancellationToken* cancel = nullptr) {
+    int remove, seam_count;
+    try {
+        width = std::stoi(fields.at("width"));
+        height = std::stoi(fields.at("height"));
+        remove = std::stoi(fields.at("remove"));
+        seam_count = fields.count("seams") ? std::stoi(fields.at("seams")) : 100;
+    } catch (std::exception& exception) {
+        return "width, height and remove are required numbers";
+    }
+    if (width < 1 || height < 1 || remove < 0 || seam_count < 1) {
+        return "width, height, remove and seams must be positive";
+    }
+    remove = std::min(remove, width - 1);
+
+    SharedFrame input;
+    SharedFrame output;
+    try {
+        std::string error = map_shared_frame(input, fields, "in", fds, static_cast<size_t>(width) * height * 4);
+        if (error.empty() && (fields.count("out_shm") || fields.count("out_fd"))) {
+            error = map_shared_frame(output, fields, "out", fds, static_cast<size_t>(width - remove) * height * 4);
+        }
+        if (!error.empty()) {
+            return error;
+        }
+    } catch (std::exception& exception) {
+        return "invalid offset or descriptor index";
+    }
+
+    auto* img = reinterpret_cast<unsigned int*>(input.pixels());
+    swap_frame_to_packed(input.pixels(), static_cast<size_t>(width) * height);
+
+    int raw_width = width;
+    CarveOptions options;
+    options.cancel = cancel;
+    if (!carve_pixels(img, width, height, remove, seam_count, workspace, options)) {
+        return "cancelled";
+    }
+
+    if (output.mapping != nullptr) {
+        auto* target = reinterpret_cast<unsigned int*>(output.pixels());
+        for (int y = 0; y < height; y++) {
+            memcpy(target + compute_offset(0, y, width, 1), img + compute_offset(0, y, raw_width, 1), width*sizeof(unsigned int));
+        }
+        swap_frame_to_packed(output.pixels(), static_cast<size_t>(width) * height);
+    }
+    else {
+        compact_rows(img, width, height, raw_width);
+        swap_frame_to_packed(input.pixels(), static_cast<size_t>(width) * height);
+    }
+    return "";
+}
+
+#endif //SEAMCARVING_SHM_FRAMES_H
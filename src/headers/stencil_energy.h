@@ -0,0 +1,98 @@
+#ifndef SEAMCARVING_STENCIL_ENERGY_H
+#define SEAMCARVING_STENCIL_ENERGY_H
+
+#include <array>
+#include <cmath>
+#include <cstdlib>
+
+//3x3 filters on the luma for LumaStencil (see main.h)
+//row() takes count pixels of a row, with upper, current and lower pointing at the first one in the rows above, at and
+//below it, and reads one pixel beyond either end. Every result stays a 16 bit energy below the border's UINT16_MAX.
+
+//row() of the filters that look at each pixel on its own, through Filter::apply()
+template <typename Filter>
+void filter_row(unsigned short* out, const unsigned char* upper, const unsigned char* current, const unsigned char* lower, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = Filter::apply(upper + i, current + i, lower + i);
+    }
+}
+
+//|Gx| + |Gy| with the 1 2 1 smoothing of the Sobel operator, at most 2040
+struct SobelFilter {
+    static unsigned short apply(const unsigned char* upper, const unsigned char* current, const unsigned char* lower) {
+        int horizontal = (upper[1] + 2 * current[1] + lower[1]) - (upper[-1] + 2 * current[-1] + lower[-1]);
+        int vertical = (lower[-1] + 2 * lower[0] + lower[1]) - (upper[-1] + 2 * upper[0] + upper[1]);
+        return std::abs(horizontal) + std::abs(vertical);
+    }
+
+    static void row(unsigned short* out, const unsigned char* upper, const unsigned char* current, const unsigned char* lower, int count) {
+        filter_row<SobelFilter>(out, upper, current, lower, count);
+    }
+};
+
+//Sobel with the 3 10 3 weights of Scharr, which are closer to rotation invariant; at most 8160
+struct ScharrFilter {
+    static unsigned short apply(const unsigned char* upper, const unsigned char* current, const unsigned char* lower) {
+        int horizontal = (3 * upper[1] + 10 * current[1] + 3 * lower[1]) - (3 * upper[-1] + 10 * current[-1] + 3 * lower[-1]);
+        int vertical = (3 * lower[-1] + 10 * lower[0] + 3 * lower[1]) - (3 * upper[-1] + 10 * upper[0] + 3 * upper[1]);
+        return std::abs(horizontal) + std::abs(vertical);
+    }
+
+    static void row(unsigned short* out, const unsigned char* upper, const unsigned char* current, const unsigned char* lower, int count) {
+        filter_row<ScharrFilter>(out, upper, current, lower, count);
+    }
+};
+
+//Magnitude of the 4 neighbour Laplacian, which keeps fine lines and text strokes rather than the edges around them;
+//at most 1020
+struct LaplacianFilter {
+    static unsigned short apply(const unsigned char* upper, const unsigned char* current, const unsigned char* lower) {
+        return std::abs(upper[0] + lower[0] + current[-1] + current[1] - 4 * current[0]);
+    }
+
+    static void row(unsigned short* out, const unsigned char* upper, const unsigned char* current, const unsigned char* lower, int count) {
+        filter_row<LaplacianFilter>(out, upper, current, lower, count);
+    }
+};
+
+//n/9 * log2(9/n) scaled by 1000, the share of the entropy of a 3x3 window from a bin holding n of its pixels
+const std::array<unsigned short, 10> entropy_terms = [] {
+    std::array<unsigned short, 10> terms{};
+    for (int n = 1; n <= 9; n++) {
+        terms[n] = static_cast<unsigned short>(std::lround(1000.0 * n / 9 * std::log2(9.0 / n)));
+    }
+    return terms;
+}();
+
+//Shannon entropy of the 3x3 window with the luma in 16 bins, times 1000 and so at most 3170
+//High in texture and noise of any contrast, low in flat and smooth areas.
+struct EntropyFilter {
+    //Slides the window along the row, so each step only moves one column of three pixels out of the histogram and one in
+    static void row(unsigned short* out, const unsigned char* upper, const unsigned char* current, const unsigned char* lower, int count) {
+        if (count <= 0) {
+            return;
+        }
+        unsigned char counts[16] = {};
+        int entropy = 0;
+        auto update = [&](int x, int step) {
+            for (const unsigned char* line : {upper, current, lower}) {
+                unsigned char& bin = counts[line[x] >> 4];
+                entropy -= entropy_terms[bin];
+                bin += step;
+                entropy += entropy_terms[bin];
+            }
+        };
+
+        update(-1, 1);
+        update(0, 1);
+        for (int i = 0; i < count; i++) {
+            if (i > 0) {
+                update(i - 2, -1);
+            }
+            update(i + 1, 1);
+            out[i] = static_cast<unsigned short>(entropy);
+        }
+    }
+};
+
+#endif //SEAMCARVING_STENCIL_ENERGY_H
@@ -0,0 +1,95 @@
+#ifndef SEAMCARVING_THREAD_POOL_H
+#define SEAMCARVING_THREAD_POOL_H
+
+#include "trace.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed size pool of worker threads executing submitted tasks in FIFO order
+class ThreadPool {
+public:
+    explicit ThreadPool(int thread_count) {
+        if (thread_count < 1) {
+            thread_count = 1;
+        }
+        for (int i = 0; i < thread_count; i++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        available.notify_one();
+    }
+
+    //Blocks until every submitted task has finished
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return tasks.empty() && running == 0; });
+    }
+
+    int size() const {
+        return static_cast<int>(workers.size());
+    }
+
+private:
+    void work() {
+        set_trace_thread_name("worker");
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                available.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                running++;
+            }
+
+            TraceSpan span("task");
+            task();
+            span.end();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running--;
+                if (tasks.empty() && running == 0) {
+                    idle.notify_all();
+                }
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::condition_variable idle;
+    int running = 0;
+    bool stopping = false;
+};
+
+#endif //SEAMCARVING_THREAD_POOL_H
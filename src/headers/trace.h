@@ -0,0 +1,176 @@
+#ifndef SEAMCARVING_TRACE_H
+#define SEAMCARVING_TRACE_H
+
+#include <string>
+
+//Spans of work per thread, written out in Chrome's trace event format for chrome://tracing and Perfetto
+//Built only with SEAMCARVING_TRACE defined; without it TraceSpan is empty and every call compiles to nothing.
+#ifdef SEAMCARVING_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent {
+    //Static string, only the pointer is kept
+    const char* name;
+    int64_t ns;
+    char phase;
+};
+
+//Ring of the last capacity events of one thread; only its own thread writes to it
+class TraceBuffer {
+public:
+    static constexpr size_t capacity = 1 << 16;
+
+    explicit TraceBuffer(int tid) : tid(tid), name("thread " + std::to_string(tid)) {}
+
+    void record(const char* event_name, char phase) {
+        if (events.empty()) {
+            events.resize(capacity);
+        }
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        events[written % capacity] = {event_name, ns, phase};
+        written++;
+    }
+
+    int tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+    size_t written = 0;
+};
+
+struct TraceRegistry {
+    std::atomic<bool> enabled{false};
+    std::mutex mutex;
+    //Kept beyond the end of their threads, so the spans of finished workers still make it into the file
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+};
+
+TraceRegistry& trace_registry() {
+    static TraceRegistry registry;
+    return registry;
+}
+
+bool trace_enabled() {
+    return trace_registry().enabled.load(std::memory_order_relaxed);
+}
+
+TraceBuffer& thread_trace_buffer() {
+    thread_local std::shared_ptr<TraceBuffer> buffer = [] {
+        TraceRegistry& registry = trace_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.buffers.push_back(std::make_shared<TraceBuffer>(static_cast<int>(registry.buffers.size()) + 1));
+        return registry.buffers.back();
+    }();
+    return *buffer;
+}
+
+//Starts recording spans on every thread
+void start_tracing() {
+    trace_registry().enabled.store(true, std::memory_order_relaxed);
+}
+
+//Names the calling thread in the trace
+void set_trace_thread_name(const char* name) {
+    if (trace_enabled()) {
+        thread_trace_buffer().name = name;
+    }
+}
+
+//Begins a span on construction and ends it on end() or destruction
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : name(trace_enabled() ? name : nullptr) {
+        if (this->name != nullptr) {
+            thread_trace_buffer().record(this->name, 'B');
+        }
+    }
+
+    ~TraceSpan() {
+        end();
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    void end() {
+        if (name != nullptr) {
+            thread_trace_buffer().record(name, 'E');
+            name = nullptr;
+        }
+    }
+
+private:
+    const char* name;
+};
+
+//Writes every recorded span as {"traceEvents": [...]}; call once the traced work has finished on all threads
+//Ends whose begin was already overwritten in a full ring are left out, so every thread's spans still nest.
+bool write_trace(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    TraceRegistry& registry = trace_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    int64_t origin = INT64_MAX;
+    for (auto& buffer : registry.buffers) {
+        size_t first = buffer->written > TraceBuffer::capacity ? buffer->written - TraceBuffer::capacity : 0;
+        if (buffer->written > first) {
+            origin = std::min(origin, buffer->events[first % TraceBuffer::capacity].ns);
+        }
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first_event = true;
+    for (auto& buffer : registry.buffers) {
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                first_event ? "" : ",\n", buffer->tid, buffer->name.c_str());
+        first_event = false;
+
+        int depth = 0;
+        size_t first = buffer->written > TraceBuffer::capacity ? buffer->written - TraceBuffer::capacity : 0;
+        for (size_t i = first; i < buffer->written; i++) {
+            const TraceEvent& event = buffer->events[i % TraceBuffer::capacity];
+            if (event.phase == 'E' && depth == 0) {
+                continue;
+            }
+            depth += event.phase == 'B' ? 1 : -1;
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f}",
+                    event.name, event.phase, buffer->tid, (event.ns - origin) / 1000.0);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+const bool trace_supported = true;
+
+#else
+
+const bool trace_supported = false;
+
+void start_tracing() {}
+
+void set_trace_thread_name(const char*) {}
+
+class TraceSpan {
+public:
+    explicit TraceSpan(const char*) {}
+
+    void end() {}
+};
+
+bool write_trace(const std::string&) {
+    return false;
+}
+
+#endif //SEAMCARVING_TRACE
+
+#endif //SEAMCARVING_TRACE_H
@@ -1,22 +1,76 @@
 #include "headers/main.h"
+#include "headers/batch.h"
+#include "headers/daemon.h"
+#include "headers/deadline.h"
+#include "headers/checkpoint.h"
+#include "headers/seam_index.h"
+#include "headers/sequence.h"
+#include <csignal>
+#include <fstream>
+#include <new>
+
+//The library's containers allocate through the global operator new, so --report counts it as well
+//Replaced here rather than in allocations.h so that only this binary pays for it: every allocation, --report or not,
+//carries a BlockHeader (alignof(std::max_align_t) bytes) and reads allocation_counters.enabled, because delete has to
+//tell counted blocks from blocks allocated before tracking started.
+//Kept out of line: inlined, GCC would see free() called on the result of new and warn about a mismatch.
+__attribute__((noinline)) void* operator new(size_t size) {
+    void* block = record_allocation(malloc(sizeof(BlockHeader) + size));
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+__attribute__((noinline)) void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+__attribute__((noinline)) void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return record_allocation(malloc(sizeof(BlockHeader) + size));
+}
+
+__attribute__((noinline)) void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+__attribute__((noinline)) void operator delete(void* block) noexcept {
+    tracked_free(block);
+}
+
+__attribute__((noinline)) void operator delete[](void* block) noexcept {
+    tracked_free(block);
+}
+
+__attribute__((noinline)) void operator delete(void* block, size_t) noexcept {
+    tracked_free(block);
+}
+
+__attribute__((noinline)) void operator delete[](void* block, size_t) noexcept {
+    tracked_free(block);
+}
 
 
-int remove_seams(const std::string& path, const std::string& out, int n, int seam_count) {
+//With deadline_ms > 0 the whole run, loading and saving included, aims to finish within that many milliseconds
+//Time spent per phase goes to metrics, if given
+int remove_seams(const std::string& path, const std::string& out, int n, int seam_count, double deadline_ms = 0, CarveMetrics* metrics = nullptr) {
+    auto started = DeadlineClock::now();
     int width, height, channels;
 
     // Load the image
+    PhaseTimer decode_timer(metrics, Phase::decode);
     unsigned char* raw_img = stbi_load(path.c_str(), &width, &height, &channels, 4);
+    decode_timer.stop();
     channels = 4;
     if (raw_img == nullptr) {
-        std::cerr << "Error" << std::endl;
+        log_error() << "Error";
         return 1;
     }
-    std::cout << "Loaded image with width of " << width << ", height of " << height << ", and " << channels << " channels." << std::endl;
+    log_info() << "Loaded image with width of " << width << ", height of " << height << ", and " << channels << " channels.";
 
     //Edge case
     if (n > width - 1) {
-        std::cout << std::endl << "####" << std::endl << "Can only remove " << width-1 << " pixels." << std::endl;
-        std::cout << "Setting to max: " << width - 1 << std::endl << "####" << std::endl << std::endl;
+        log_info() << "Can only remove " << width-1 << " pixels, setting to max: " << width - 1;
 
         n = width - 1;
     }
@@ -25,86 +79,592 @@ int remove_seams(const std::string& path, const std::string& out, int n, int sea
     //Since arrays will not be resized during operations, raw_width must be kept to calculate correct index
     int raw_width = width;
 
-    //Convert image from separate channels as char-array to combined channel int array for efficiency
-    std::cout << "Converting image" << std::endl;
-    unsigned int* img = convert_to_int(raw_img, width, height, channels);
-    unsigned char* grayscale_img = grayscale(img, width, height, raw_width);
+    //Convert image from separate channels as char-array to combined channel int array for efficiency,
+    //together with its energy map
+    CarveWorkspace workspace;
+    prepare_carve_rgba(raw_img, width, height, workspace, metrics);
     stbi_image_free(raw_img);
     channels = 1;
-    std::cout << "Convert successful" << std::endl;
+    unsigned int* img = workspace.pixels.data();
+
+    CarveOptions options;
+    options.metrics = metrics;
+    if (deadline_ms > 0) {
+        auto deadline = started + std::chrono::duration_cast<DeadlineClock::duration>(std::chrono::duration<double, std::milli>(deadline_ms));
+        DeadlineReport report;
+        carve_with_deadline(img, width, height, raw_width, n, seam_count, workspace, deadline - predicted_encode_time(width - n, height), report, options);
+        log_info() << "Strategy: " << strategy_name(report.strategy) << " (" << report.exact_seams << " exact seams, "
+                   << report.batch_seams << " batched seams, " << report.resampled_pixels << " pixels resampled)";
+    }
+    else {
+        carve_prepared(img, width, height, raw_width, n, seam_count, workspace, options);
+    }
+
+    //Convert image back to byte array with separate channels in order to save
+    log_debug() << "Converting image back and saving";
+    PhaseTimer encode_timer(metrics, Phase::encode);
+    img = compacted_copy(img, width, height, raw_width);
+    raw_img = convert_to_char(img, width, height, 4);
+    channels = 4;
+
+    bool saved = stbi_write_png(out.c_str(), width, height, channels, raw_img, width * channels);
+    encode_timer.stop();
+    if (!saved) {
+        log_error() << "Error in saving the image";
+        tracked_free(img);
+        stbi_image_free(raw_img);
+        return 1;
+    }
 
-    std::vector<unsigned short> energy(width*height);
-    std::vector<std::vector<int>> seams(width);
-    std::vector<int> seam_weights(width);
+    log_info() << "image saved successfully.";
 
-    //Energy map must only be calculated once, and will only be partially recalculated (see main.h: remove_seam())
-    std::cout << "Generating energy map" << std::endl;
-    generate_energy_map(energy, grayscale_img, width, height, raw_width);
-    std::cout << "Energy map generated, commencing seam removal" << std::endl << "-------------" << std::endl << std::endl;
+    // Free the image memory
+    tracked_free(img);
+    stbi_image_free(raw_img);
 
-    auto start_total = std::chrono::high_resolution_clock::now();
+    return 0;
+}
 
-    for (int i = 0; i < n; i++) {
-        std::cout << "Seam no. " << i+1 << std::endl;
 
-        std::cout << "Generated map, building seams" << std::endl;
-        auto start = std::chrono::high_resolution_clock::now();
-        generate_seams(seams, seam_weights, energy, width, height, raw_width, seam_count);
-        auto end = std::chrono::high_resolution_clock::now();
-        auto dur = end - start;
-        std::cout << "Took: " << dur.count()/1000000 << "ms" << std::endl;
+//Triggered by SIGTERM/SIGINT while a resumable carve runs
+CancellationToken* interrupted = nullptr;
 
-        std::cout << "Seams built, removing seam" << std::endl;
-        start = std::chrono::high_resolution_clock::now();
-        remove_seam(img, seams, seam_weights, energy, width, height, raw_width, grayscale_img);
-        end = std::chrono::high_resolution_clock::now();
-        dur = end - start;
-        std::cout << "Took: " << dur.count()/1000000 << "ms" << std::endl;
+void cancel_on_signal(int) {
+    if (interrupted != nullptr) {
+        interrupted->cancel();
+    }
+}
+
+//Like remove_seams, but saves the carve's state to checkpoint every interval_s seconds and when preempted by
+//SIGTERM/SIGINT; if checkpoint already holds a carve of the same input, that one is continued instead
+int remove_seams_resumable(const std::string& path, const std::string& out, int n, int seam_count, const std::string& checkpoint, double interval_s,
+                           CarveMetrics* metrics = nullptr) {
+    std::vector<unsigned char> bytes;
+    if (!read_whole_file(path, bytes)) {
+        log_error() << "Error";
+        return 1;
+    }
+    uint64_t hash = hash_bytes(bytes.data(), bytes.size());
 
-        std::cout << "******" << std::endl;
+    CarveWorkspace workspace;
+    CarveCheckpoint state;
+    int width, height;
+    if (load_checkpoint(checkpoint, state, workspace) && state.resumes(hash, n, seam_count, workspace.energy_kind)) {
+        width = state.width;
+        height = state.height;
+        log_info() << "Resuming from checkpoint after " << state.removed << " seams, width of " << width;
+    }
+    else {
+        int channels;
+        PhaseTimer decode_timer(metrics, Phase::decode);
+        unsigned char* raw_img = stbi_load_from_memory(bytes.data(), static_cast<int>(bytes.size()), &width, &height, &channels, 4);
+        decode_timer.stop();
+        if (raw_img == nullptr) {
+            log_error() << "Error";
+            return 1;
+        }
+        log_info() << "Loaded image with width of " << width << ", height of " << height;
+        prepare_carve_rgba(raw_img, width, height, workspace, metrics);
+        stbi_image_free(raw_img);
+        state = CarveCheckpoint{hash, n, seam_count, 0, width, height, workspace.energy_kind};
     }
+    bytes = std::vector<unsigned char>();
 
-    std::cout << std::endl;
-    auto end_total = std::chrono::high_resolution_clock::now();
-    auto dur_total = end_total - start_total;
-    std::cout << "Total: " << dur_total.count()/1000000 << "ms" << std::endl;
-    std::cout << std::endl;
+    unsigned int* img = workspace.pixels.data();
+    int raw_width = width;
+    int resumed_at = state.removed;
+    auto save = [&](int removed) {
+        state.removed = resumed_at + removed;
+        state.width = width;
+        if (!save_checkpoint(checkpoint, state, img, workspace, raw_width)) {
+            log_error() << "Error in saving the checkpoint";
+        }
+    };
 
-    //Convert image back to byte array with separate channels in order to save
-    std::cout << "Converting image back and saving" << std::endl;
-    img = postprocess(img, width, height, raw_width);
-    raw_img = convert_to_char(img, width, height, 4);
-    channels = 4;
+    CancellationToken preempted;
+    interrupted = &preempted;
+    std::signal(SIGTERM, cancel_on_signal);
+    std::signal(SIGINT, cancel_on_signal);
 
-    if (!stbi_write_png(out.c_str(), width, height, channels, raw_img, width * channels)) {
-        std::cerr << "Error in saving the image" << std::endl;
-        free(grayscale_img);
-        free(img);
+    int removed = 0;
+    auto last_save = std::chrono::steady_clock::now();
+    CarveOptions options;
+    options.cancel = &preempted;
+    options.metrics = metrics;
+    options.on_progress = [&](int done, int, double) {
+        removed = done;
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - last_save).count() >= interval_s) {
+            save(removed);
+            last_save = now;
+        }
+    };
+    bool finished = carve_prepared(img, width, height, raw_width, std::min(n - resumed_at, width - 1), seam_count, workspace, options);
+
+    std::signal(SIGTERM, SIG_DFL);
+    std::signal(SIGINT, SIG_DFL);
+    interrupted = nullptr;
+    if (!finished) {
+        save(removed);
+        log_info() << "Interrupted, checkpoint saved after " << state.removed << " seams";
+        return 1;
+    }
+
+    PhaseTimer encode_timer(metrics, Phase::encode);
+    unsigned int* result = compacted_copy(img, width, height, raw_width);
+    unsigned char* raw_img = convert_to_char(result, width, height, 4);
+    tracked_free(result);
+    int ok = stbi_write_png(out.c_str(), width, height, 4, raw_img, width * 4);
+    tracked_free(raw_img);
+    encode_timer.stop();
+    if (!ok) {
+        log_error() << "Error in saving the image";
+        return 1;
+    }
+    remove(checkpoint.c_str());
+    log_info() << "image saved successfully.";
+    return 0;
+}
+
+//Writes <output>_<width>.png for every target width, encoding on other threads while the carve goes on
+int remove_seams_multi(const std::string& path, const std::string& out, const std::vector<int>& targets, int seam_count) {
+    int width, height, channels;
+    unsigned char* raw_img = stbi_load(path.c_str(), &width, &height, &channels, 4);
+    if (raw_img == nullptr) {
+        log_error() << "Error";
+        return 1;
+    }
+    log_info() << "Loaded image with width of " << width << ", height of " << height;
+
+    unsigned int* img = convert_to_int(raw_img, width, height, 4);
+    stbi_image_free(raw_img);
+
+    std::string stem = out.ends_with(".png") ? out.substr(0, out.size() - 4) : out;
+    std::atomic<int> failures{0};
+    CarveWorkspace workspace;
+    {
+        ThreadPool encoders(std::max(2u, std::thread::hardware_concurrency()) - 1);
+        carve_to_targets(img, width, height, targets, seam_count, workspace, [&](const unsigned int* carved, int w, int h, int raw_width) {
+            unsigned int* copy = compacted_copy(carved, w, h, raw_width);
+            encoders.submit([copy, w, h, &stem, &failures] {
+                unsigned char* bytes = convert_to_char(copy, w, h, 4);
+                tracked_free(copy);
+                std::string file = stem + "_" + std::to_string(w) + ".png";
+                if (!stbi_write_png(file.c_str(), w, h, 4, bytes, w * 4)) {
+                    log_error() << "Error in saving " << file;
+                    failures++;
+                }
+                else {
+                    log_info() << "Saved " << file;
+                }
+                tracked_free(bytes);
+            });
+        });
+        encoders.wait_idle();
+    }
+    tracked_free(img);
+
+    return failures == 0 ? 0 : 1;
+}
+
+int build_index(const std::string& path, const std::string& index_path, int seam_count) {
+    int width, height, channels;
+    unsigned char* raw_img = stbi_load(path.c_str(), &width, &height, &channels, 4);
+    if (raw_img == nullptr) {
+        log_error() << "Error";
+        return 1;
+    }
+    if (width > max_index_width) {
+        log_error() << "Error: the index supports widths up to " << max_index_width << " pixels";
         stbi_image_free(raw_img);
         return 1;
     }
 
-    std::cout << "image saved successfully." << std::endl;
+    unsigned int* img = convert_to_int(raw_img, width, height, 4);
+    stbi_image_free(raw_img);
 
-    // Free the image memory
-    free(grayscale_img);
-    free(img);
+    SeamOrderIndex index;
+    CarveWorkspace workspace;
+    log_info() << "Carving " << width << "x" << height << " down to a width of 1";
+    build_seam_order_index(img, width, height, seam_count, index, workspace);
+    tracked_free(img);
+
+    if (!save_seam_order_index(index_path, index)) {
+        log_error() << "Error in saving the index";
+        return 1;
+    }
+    log_info() << "index saved successfully.";
+    return 0;
+}
+
+int retarget(const std::string& path, const std::string& index_path, const std::string& out, int target_width) {
+    SeamOrderIndex index;
+    if (!load_seam_order_index(index_path, index)) {
+        log_error() << "Error in loading the index";
+        return 1;
+    }
+
+    int width, height, channels;
+    unsigned char* raw_img = stbi_load(path.c_str(), &width, &height, &channels, 4);
+    if (raw_img == nullptr) {
+        log_error() << "Error";
+        return 1;
+    }
+    if (width != index.width || height != index.height) {
+        log_error() << "Error: index was built for a " << index.width << "x" << index.height << " image";
+        stbi_image_free(raw_img);
+        return 1;
+    }
+
+    target_width = std::clamp(target_width, 1, width);
+    unsigned char* result = retarget_with_index(raw_img, index, target_width);
     stbi_image_free(raw_img);
 
+    int ok = stbi_write_png(out.c_str(), target_width, height, 4, result, target_width * 4);
+    tracked_free(result);
+    if (!ok) {
+        log_error() << "Error in saving the image";
+        return 1;
+    }
+    log_info() << "image saved successfully.";
     return 0;
 }
 
+//Reads trailing "--option value" pairs (and bare "--flag"s) starting at argv[first]
+//--quiet, --log-level LEVEL and --energy NAME are applied right away instead of being returned, every command accepts them
+//Where --trace writes the spans of the run once the command is done, empty without --trace
+std::string trace_path;
 
+bool parse_options(int argc, char* argv[], int first, std::vector<std::pair<std::string, std::string>>& options) {
+    for (int i = first; i < argc; i++) {
+        std::string key(argv[i]);
+        if (!key.starts_with("--")) {
+            std::cout << "Error: unexpected argument " << key << std::endl;
+            return false;
+        }
+        if (i + 1 < argc && !std::string(argv[i+1]).starts_with("--")) {
+            options.emplace_back(key, argv[++i]);
+        }
+        else {
+            options.emplace_back(key, "");
+        }
 
-int main(int argc, char* argv[]) {
-    if (argc == 5) {
+        if (key == "--quiet") {
+            set_log_level(LogLevel::error);
+            options.pop_back();
+        }
+        else if (key == "--log-level") {
+            LogLevel level;
+            if (!parse_log_level(options.back().second, level)) {
+                std::cout << "Error: log level must be error, info, debug or trace" << std::endl;
+                return false;
+            }
+            set_log_level(level);
+            options.pop_back();
+        }
+        else if (key == "--energy") {
+            if (!parse_energy(options.back().second, default_energy_kind)) {
+                std::cout << "Error: energy must be one of " << energy_names() << std::endl;
+                return false;
+            }
+            options.pop_back();
+        }
+        else if (key == "--trace") {
+            if (!trace_supported) {
+                std::cout << "Error: --trace needs a build with -DSEAMCARVING_TRACE=ON" << std::endl;
+                return false;
+            }
+            trace_path = options.back().second;
+            start_tracing();
+            set_trace_thread_name("main");
+            options.pop_back();
+        }
+    }
+    return true;
+}
+
+//For the commands without options of their own, which still take the global ones
+bool parse_global_options(int argc, char* argv[], int first) {
+    std::vector<std::pair<std::string, std::string>> flags;
+    if (!parse_options(argc, argv, first, flags)) {
+        return false;
+    }
+    if (!flags.empty()) {
+        std::cout << "Error: unknown option " << flags.front().first << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int batch_command(int argc, char* argv[]) {
+    set_log_level(LogLevel::error);
+    BatchOptions options;
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::pair<std::string, std::string>> flags;
+
+    try {
+        options.remove = std::stoi(std::string(argv[4]));
+        options.seam_count = std::stoi(std::string(argv[5]));
+        if (!parse_options(argc, argv, 6, flags)) {
+            return 1;
+        }
+        for (auto& [key, value] : flags) {
+            if (key == "--threads") {
+                options.threads = std::stoi(value);
+            }
+            else if (key == "--queue-depth") {
+                options.queue_depth = std::max(1, std::stoi(value));
+            }
+            else if (key == "--no-uring") {
+                options.use_uring = false;
+            }
+            else if (key == "--memory-budget") {
+                options.memory_budget = std::stoull(value) << 20;
+            }
+            else {
+                std::cout << "Error: unknown option " << key << std::endl;
+                return 1;
+            }
+        }
+    } catch (std::invalid_argument& invalidArgument) {
+        std::cout << "Error: invalid input number" << std::endl;
+        return 1;
+    }
+
+    std::ifstream list(argv[2]);
+    if (!list) {
+        std::cout << "Error: cannot open input list " << argv[2] << std::endl;
+        return 1;
+    }
+    std::vector<std::string> inputs;
+    for (std::string line; std::getline(list, line);) {
+        if (!line.empty()) {
+            inputs.push_back(line);
+        }
+    }
+
+    return run_batch(inputs, argv[3], options);
+}
+
+int daemon_command(int argc, char* argv[]) {
+    set_log_level(LogLevel::error);
+    DaemonOptions options;
+    options.socket_path = argv[2];
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::pair<std::string, std::string>> flags;
+
+    try {
+        if (!parse_options(argc, argv, 3, flags)) {
+            return 1;
+        }
+        for (auto& [key, value] : flags) {
+            if (key == "--threads") {
+                options.threads = std::stoi(value);
+            }
+            else if (key == "--max-inflight") {
+                options.max_inflight = std::max(1, std::stoi(value));
+            }
+            else if (key == "--max-connections") {
+                options.max_connections = std::max(1, std::stoi(value));
+            }
+            else if (key == "--memory-budget") {
+                options.memory_budget = std::stoull(value) << 20;
+            }
+            else if (key == "--cache-mb") {
+                options.cache_bytes = std::stoull(value) << 20;
+            }
+            else if (key == "--cache-dir") {
+                options.cache_dir = value;
+            }
+            else if (key == "--root") {
+                std::error_code error;
+                options.root = std::filesystem::canonical(value, error).string();
+                if (error || !std::filesystem::is_directory(options.root)) {
+                    std::cout << "Error: " << value << " is not a directory" << std::endl;
+                    return 1;
+                }
+            }
+            else {
+                std::cout << "Error: unknown option " << key << std::endl;
+                return 1;
+            }
+        }
+    } catch (std::invalid_argument& invalidArgument) {
+        std::cout << "Error: invalid input number" << std::endl;
+        return 1;
+    }
+
+    return run_daemon(options);
+}
+
+int sequence_command(int argc, char* argv[]) {
+    set_log_level(LogLevel::error);
+    SequenceOptions options;
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::pair<std::string, std::string>> flags;
+
+    try {
+        options.remove = std::stoi(std::string(argv[4]));
+        options.seam_count = std::stoi(std::string(argv[5]));
+        if (!parse_options(argc, argv, 6, flags)) {
+            return 1;
+        }
+        for (auto& [key, value] : flags) {
+            if (key == "--threads") {
+                options.threads = std::max(1, std::stoi(value));
+            }
+            else if (key == "--band") {
+                options.band = std::stoi(value);
+            }
+            else if (key == "--independent") {
+                options.band = -1;
+            }
+            else if (key == "--size") {
+                size_t x = value.find('x');
+                if (x == std::string::npos) {
+                    throw std::invalid_argument(value);
+                }
+                options.width = std::stoi(value.substr(0, x));
+                options.height = std::stoi(value.substr(x + 1));
+            }
+            else {
+                std::cout << "Error: unknown option " << key << std::endl;
+                return 1;
+            }
+        }
+    } catch (std::invalid_argument& invalidArgument) {
+        std::cout << "Error: invalid input number" << std::endl;
+        return 1;
+    }
+
+    std::string input(argv[2]);
+    std::string output(argv[3]);
+    if (input != "-") {
+        if (!std::filesystem::is_directory(input)) {
+            std::cout << "Error: " << input << " is not a directory" << std::endl;
+            return 1;
+        }
+        std::filesystem::create_directories(output);
+        auto source = FrameSource::files(list_frames(input));
+        return run_sequence(*source, output, nullptr, options);
+    }
+
+    if (options.width <= 0 || options.height <= 0) {
+        std::cout << "Error: raw frame streams need --size WxH" << std::endl;
+        return 1;
+    }
+    FILE* file = output == "-" ? stdout : fopen(output.c_str(), "wb");
+    if (file == nullptr) {
+        std::cout << "Error: cannot open " << output << std::endl;
+        return 1;
+    }
+    //Progress output must not end up between the frames
+    std::streambuf* console = std::cout.rdbuf();
+    if (file == stdout) {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+    auto source = FrameSource::stream(stdin, options.width, options.height);
+    int result = run_sequence(*source, "", file, options);
+    std::cout.rdbuf(console);
+    if (file != stdout && fclose(file) != 0) {
+        log_error() << "Error: cannot write " << output;
+        return 1;
+    }
+    return result;
+}
+
+int run_command(int argc, char* argv[]) {
+    if (argc >= 6 && std::string(argv[1]) == "batch") {
+        return batch_command(argc, argv);
+    }
+    if (argc >= 3 && std::string(argv[1]) == "daemon") {
+        return daemon_command(argc, argv);
+    }
+    if (argc >= 6 && std::string(argv[1]) == "sequence") {
+        return sequence_command(argc, argv);
+    }
+    if (argc >= 6 && std::string(argv[1]) == "multi") {
+        std::vector<int> targets;
+        try {
+            if (!parse_global_options(argc, argv, 6)) {
+                return 1;
+            }
+            int seams = std::stoi(std::string(argv[4]));
+            std::string list(argv[5]);
+            for (size_t start = 0; start < list.size();) {
+                size_t comma = list.find(',', start);
+                if (comma == std::string::npos) {
+                    comma = list.size();
+                }
+                targets.push_back(std::stoi(list.substr(start, comma - start)));
+                start = comma + 1;
+            }
+            return remove_seams_multi(argv[2], argv[3], targets, seams);
+        } catch (std::invalid_argument& invalidArgument) {
+            std::cout << "Error: invalid input number" << std::endl;
+            return 1;
+        }
+    }
+    bool index = argc >= 5 && std::string(argv[1]) == "index";
+    if (index || (argc >= 6 && std::string(argv[1]) == "retarget")) {
+        int first_option = index ? 5 : 6;
+        int number;
+        try {
+            number = std::stoi(std::string(argv[first_option - 1]));
+        } catch (std::invalid_argument& invalidArgument) {
+            std::cout << "Error: invalid input number" << std::endl;
+            return 1;
+        }
+        if (!parse_global_options(argc, argv, first_option)) {
+            return 1;
+        }
+        if (index) {
+            return build_index(argv[2], argv[3], number);
+        }
+        std::string out(argv[4]);
+        if (!out.ends_with(".png")) {
+            out.append(".png");
+        }
+        return retarget(argv[2], argv[3], out, number);
+    }
+    if (argc >= 5) {
         std::string src(argv[1]);
         std::string out(argv[2]);
         int remove;
         int seams;
+        double deadline_ms = 0;
+        std::string checkpoint;
+        double checkpoint_interval = 120;
+        std::string report;
+        bool counters = false;
+        std::vector<std::pair<std::string, std::string>> flags;
         try {
             remove = std::stoi(std::string(argv[3]));
             seams = std::stoi(std::string(argv[4]));
+            if (!parse_options(argc, argv, 5, flags)) {
+                return 1;
+            }
+            for (auto& [key, value] : flags) {
+                if (key == "--deadline") {
+                    deadline_ms = std::stod(value);
+                }
+                else if (key == "--checkpoint") {
+                    checkpoint = value;
+                }
+                else if (key == "--checkpoint-interval") {
+                    checkpoint_interval = std::stod(value);
+                }
+                else if (key == "--report") {
+                    report = value;
+                }
+                else if (key == "--counters") {
+                    counters = true;
+                }
+                else {
+                    std::cout << "Error: unknown option " << key << std::endl;
+                    return 1;
+                }
+            }
         } catch (std::invalid_argument& invalidArgument){
             std::cout << "Error: invalid input number at <number of pixels to remove> or <number of seams>" << std::endl;
             return 1;
@@ -115,7 +675,44 @@ int main(int argc, char* argv[]) {
             if (!out.ends_with(".png")) {
                 out.append(".png");
             }
-            return remove_seams(src, out, remove, seams);
+            if (!checkpoint.empty() && deadline_ms > 0) {
+                std::cout << "Error: --checkpoint and --deadline cannot be combined" << std::endl;
+                return 1;
+            }
+            if (counters && report.empty()) {
+                std::cout << "Error: --counters needs --report" << std::endl;
+                return 1;
+            }
+            CarveMetrics metrics;
+            CarveMetrics* collected = report.empty() ? nullptr : &metrics;
+            if (collected != nullptr) {
+                start_allocation_tracking();
+            }
+            std::unique_ptr<PerfCounters> perf_counters;
+            if (counters) {
+                perf_counters = std::make_unique<PerfCounters>();
+                if (!perf_counters->available()) {
+                    log_info() << "Hardware counters are unavailable (" << perf_counters->unavailable_reason() << "), reporting timings only";
+                }
+                else if (!perf_counters->unavailable_reason().empty()) {
+                    log_info() << "Some hardware counters are unavailable (" << perf_counters->unavailable_reason() << ")";
+                }
+                metrics.use_counters(perf_counters.get());
+            }
+            int result = checkpoint.empty() ? remove_seams(src, out, remove, seams, deadline_ms, collected)
+                                            : remove_seams_resumable(src, out, remove, seams, checkpoint, checkpoint_interval, collected);
+            if (collected != nullptr) {
+                metrics.describe("input", src);
+                metrics.describe("output", out);
+                metrics.describe("remove", remove);
+                metrics.describe("seam_count", seams);
+                metrics.describe("status", result == 0 ? "ok" : "failed");
+                if (!metrics.write_json(report)) {
+                    log_error() << "Error in writing the report to " << report;
+                    return 1;
+                }
+            }
+            return result;
         }
         else {
             std::cout << "Error: supported File formats are .png, .jpg" << std::endl;
@@ -125,7 +722,7 @@ int main(int argc, char* argv[]) {
     if (argc == 2) {
         std::string in = argv[1];
         if (in == "help") {
-            std::cout << "SeamCarving.exe <input path> <output path> <number of pixels to remove> <number of seams>" << std::endl << std::endl;
+            std::cout << "SeamCarving.exe <input path> <output path> <number of pixels to remove> <number of seams> [--deadline MS]" << std::endl << std::endl;
             std::cout << "<input path>\tPath of input picture, can be absolute or relative." << std::endl;
             std::cout << "\t\tSupported file formats: .png, .jpg/.JPG." << std::endl << std::endl;
             std::cout << "<output path>\tPath to output picture, can be absolute or relative." << std::endl;
@@ -133,11 +730,70 @@ int main(int argc, char* argv[]) {
             std::cout << "<number of pixels to remove>" << std::endl << std::endl;
             std::cout << "<number of seams>\t*advanced setting*" << std::endl;
             std::cout << "\t\tSpecifies the number of seams being calculated, trading accuracy for speed." << std::endl;
-            std::cout << "\t\tValue 100 will be best for most cases." << std::endl;
+            std::cout << "\t\tValue 100 will be best for most cases." << std::endl << std::endl;
+            std::cout << "--deadline MS\tFinish within MS milliseconds, removing several seams per search or resampling" << std::endl;
+            std::cout << "\t\tthe rest of the width when carving seam by seam would take too long." << std::endl << std::endl;
+            std::cout << "--checkpoint PATH\tSave the state of the carve to PATH every --checkpoint-interval seconds (default 120)" << std::endl;
+            std::cout << "\t\tand on SIGTERM/SIGINT; running again with the same arguments resumes from it." << std::endl << std::endl;
+            std::cout << "--report PATH\tWrite the time spent decoding, converting, computing the energy map (in the same pass)," << std::endl;
+            std::cout << "\t\tsearching and removing seams and encoding, with per-seam percentiles, to PATH as JSON. Also lists the" << std::endl;
+            std::cout << "\t\tallocations, bytes and peak live bytes of every phase and the allocations made per seam." << std::endl << std::endl;
+            std::cout << "--counters\tAdd cycles, instructions, L1/LLC misses and branch misses per phase to the --report," << std::endl;
+            std::cout << "\t\tas far as perf_event_open() is permitted." << std::endl << std::endl;
+            std::cout << "--trace PATH\tRecord every phase, seam and worker task and write them to PATH (builds with -DSEAMCARVING_TRACE=ON)" << std::endl;
+            std::cout << "\t\tin Chrome's trace event format, for chrome://tracing or Perfetto." << std::endl << std::endl;
+            std::cout << "--energy NAME\tEnergy function: gradient (default) of the luma; color, a dual gradient on R, G and B" << std::endl;
+            std::cout << "\t\tthat also sees edges between colours of the same brightness; forward, the luma" << std::endl;
+            std::cout << "\t\tedges a removal creates, which leaves fewer artifacts; sobel or scharr, smoother" << std::endl;
+            std::cout << "\t\tgradients for photos and faces; laplacian, which keeps thin lines such as text;" << std::endl;
+            std::cout << "\t\tor entropy, the local entropy of the luma, which keeps textures." << std::endl << std::endl;
+            std::cout << "--log-level L\tOne of error, info (default), debug and trace; only trace reports every seam." << std::endl;
+            std::cout << "--quiet\t\tSame as --log-level error, the default of batch, sequence and daemon mode." << std::endl;
+            std::cout << "--energy, --trace, --log-level and --quiet can be given to every command below as well." << std::endl << std::endl;
+            std::cout << "SeamCarving.exe batch <input list> <output dir> <number of pixels to remove> <number of seams> [options]" << std::endl << std::endl;
+            std::cout << "<input list>\tText file with one input path per line." << std::endl;
+            std::cout << "<output dir>\tEvery input is written there as <input name>.png; inputs whose names only differ in" << std::endl;
+            std::cout << "\t\ttheir directory or extension fail instead of overwriting each other." << std::endl;
+            std::cout << "--threads N\tNumber of carving threads, defaults to the number of cores." << std::endl;
+            std::cout << "--queue-depth N\tNumber of inputs read ahead of the carving threads, default 8." << std::endl;
+            std::cout << "--no-uring\tUse blocking I/O threads instead of io_uring." << std::endl;
+            std::cout << "--memory-budget MB\tPredicted peak memory of all running carves, defaults to 3/4 of RAM." << std::endl;
+            std::cout << std::endl << "SeamCarving.exe multi <input path> <output path> <number of seams> <width,width,...> [options]" << std::endl << std::endl;
+            std::cout << "Writes <output path>_<width>.png for every listed width from a single carve." << std::endl;
+            std::cout << std::endl << "SeamCarving.exe index <input path> <index path> <number of seams> [options]" << std::endl << std::endl;
+            std::cout << "Carves the input down to a width of 1 and saves the order in which its pixels were removed." << std::endl;
+            std::cout << std::endl << "SeamCarving.exe retarget <input path> <index path> <output path> <target width> [options]" << std::endl << std::endl;
+            std::cout << "Produces any width from the input and its index in a single pass, without carving again." << std::endl;
+            std::cout << std::endl << "SeamCarving.exe sequence <frame dir|-> <output dir|output file|-> <number of pixels to remove> <number of seams> [options]" << std::endl << std::endl;
+            std::cout << "Carves the frames of a video in name order, each one following the seams of the frame before it." << std::endl;
+            std::cout << "'-' as input reads raw RGBA frames from stdin and writes the carved frames to the output file, or stdout for '-'." << std::endl;
+            std::cout << "--size WxH\tFrame size of raw input." << std::endl;
+            std::cout << "--band N\tHow far a seam may move from the previous frame's seam, default 8." << std::endl;
+            std::cout << "--independent\tCarve every frame on its own." << std::endl;
+            std::cout << "--threads N\tNumber of frames carved at once, defaults to the number of cores." << std::endl;
+            std::cout << std::endl << "SeamCarving.exe daemon <socket path> [options]" << std::endl << std::endl;
+            std::cout << "Serves carve requests on a Unix domain socket until SIGTERM, see headers/daemon.h for the protocol." << std::endl;
+            std::cout << "--threads N\tNumber of carving threads, defaults to the number of cores." << std::endl;
+            std::cout << "--max-inflight N\tCarves queued or running at once before requests are rejected, default 16." << std::endl;
+            std::cout << "--max-connections N\tOpen client connections at once, default 64." << std::endl;
+            std::cout << "--cache-mb MB\tSize of the in-memory cache of decoded images and energy maps, default 256, 0 disables it." << std::endl;
+            std::cout << "--cache-dir DIR\tAlso keep cached images on disk in DIR." << std::endl;
+            std::cout << "--root DIR\tOnly read in= and write out= paths within DIR, relative ones from there. Without it" << std::endl;
+            std::cout << "\t\tclients can read and write any file the daemon can." << std::endl;
+            std::cout << "--memory-budget MB\tPredicted peak memory of all running carves, defaults to 3/4 of RAM." << std::endl;
             return 0;
         }
     }
     std::cout << "Error: please use SeamCarving.exe <input path> <output path> <number of pixels to remove> <number of seams>" << std::endl;
     std::cout << "Type 'SeamCarving.exe help' for more info" << std::endl;
     return 1;
-}
\ No newline at end of file
+}
+
+int main(int argc, char* argv[]) {
+    int result = run_command(argc, argv);
+    if (!trace_path.empty() && !write_trace(trace_path)) {
+        log_error() << "Error in writing the trace to " << trace_path;
+        return 1;
+    }
+    return result;
+}